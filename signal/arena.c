@@ -0,0 +1,85 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/mman.h>
+
+#include "arena.h"
+
+int arena_init(arena_t *arena, size_t size, int flags) {
+    int ret = 0;
+    size_t huge_size;
+    void *base = MAP_FAILED;
+
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+    if (size == 0) {
+        goto out;
+    }
+
+    // Anonymous mappings come back zeroed, and pages are only touched
+    // when first written
+#ifdef MAP_HUGETLB
+    if (flags & ARENA_HUGE_PAGES) {
+        // munmap of a huge page mapping fails unless its length is a
+        // whole number of huge pages, so the arena is made one
+        huge_size = (size + ARENA_HUGE_PAGE_SIZE - 1)
+            & ~(ARENA_HUGE_PAGE_SIZE - 1);
+        base = mmap(NULL, huge_size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (base != MAP_FAILED) {
+            size = huge_size;
+        }
+    }
+#endif
+    if (base == MAP_FAILED) {
+        // No reserved huge pages - fall back to normal pages, and ask for
+        // transparent huge pages instead if requested
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            ret = 1;
+            goto out;
+        }
+#ifdef MADV_HUGEPAGE
+        if (flags & ARENA_HUGE_PAGES) {
+            madvise(base, size, MADV_HUGEPAGE);
+        }
+#endif
+    }
+
+    arena->base = base;
+    arena->size = size;
+out:
+    return ret;
+}
+
+void *arena_alloc(arena_t *arena, size_t size) {
+    void *block = NULL;
+    size_t start;
+
+    start = (arena->used + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1);
+    if (arena->base != NULL) {
+        if (start + size > arena->size) {
+            goto out;
+        }
+        block = arena->base + start;
+    }
+    arena->used = start + size;
+out:
+    return block;
+}
+
+int arena_free(arena_t *arena) {
+    int ret = 0;
+
+    if (arena->base != NULL) {
+        ret = munmap(arena->base, arena->size);
+    }
+    arena->base = NULL;
+    arena->size = 0;
+    arena->used = 0;
+
+    return ret;
+}
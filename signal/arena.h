@@ -0,0 +1,30 @@
+#ifndef ARENA
+#define ARENA
+#include <stddef.h>
+
+// Flags for arena_init
+#define ARENA_HUGE_PAGES 1
+
+// Every block handed out by arena_alloc starts on its own cache line
+#define ARENA_ALIGN 64
+
+// Size of the default huge page that MAP_HUGETLB maps with, which
+// huge page arenas are rounded up to
+#define ARENA_HUGE_PAGE_SIZE ((size_t) 2 << 20)
+
+// A single zeroed mapping carved up by bumping an offset. Blocks are never
+// freed individually - arena_free releases the whole mapping at once.
+//
+// An arena with a NULL base can be used to measure a layout: arena_alloc
+// returns NULL but still advances used, which can then be passed to
+// arena_init as the size.
+typedef struct {
+    char *base;
+    size_t size;
+    size_t used;
+} arena_t;
+
+int arena_init(arena_t *arena, size_t size, int flags);
+void *arena_alloc(arena_t *arena, size_t size);
+int arena_free(arena_t *arena);
+#endif
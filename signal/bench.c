@@ -0,0 +1,314 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "signal.h"
+#include "rng.h"
+#include "pedfile.h"
+#include "pedgen.h"
+
+// Times the core operations of the library on synthetic pedigrees, scaling
+// the depth of the pedigree and the number of samples. Each measurement is
+// one tab-separated line of the output file, under a header line, so runs
+// can be compared to catch regressions. Times are in nanoseconds. The
+// library's own messages still go to stdout.
+
+#define BENCH_MAX_CONFIGS 16
+
+typedef struct {
+    uint32_t len;
+    uint32_t capacity;
+    double *ns;
+} timings_t;
+
+static double now_ns(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int timings_add(timings_t *t, double ns) {
+    double *ns_array;
+
+    if (t->len == t->capacity) {
+        t->capacity = t->capacity == 0 ? 64 : 2 * t->capacity;
+        ns_array = realloc(t->ns, t->capacity * sizeof(double));
+        if (ns_array == NULL) {
+            return 1;
+        }
+        t->ns = ns_array;
+    }
+    t->ns[t->len++] = ns;
+    return 0;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *) a, y = *(const double *) b;
+
+    return (x > y) - (x < y);
+}
+
+static void timings_report(FILE *out, timings_t *t, const char *name,
+        const pedgen_params_t *params, uint32_t num_samples,
+        uint32_t num_nodes) {
+    uint32_t i;
+    double sum = 0;
+
+    if (t->len == 0) {
+        return;
+    }
+    qsort(t->ns, t->len, sizeof(double), compare_double);
+    for (i = 0; i < t->len; i++) {
+        sum += t->ns[i];
+    }
+    fprintf(out, "%s\t%u\t%u\t%u\t%u\t%u\t%.0f\t%.0f\t%.0f\n", name,
+            params->num_generations, params->pop_size, num_samples, num_nodes,
+            t->len, t->ns[0], t->ns[t->len / 2], sum / t->len);
+    fflush(out);
+    t->len = 0;
+}
+
+static ped_t *bench_load(const pedfile_t *pf, uint32_t num_samples,
+        unsigned long seed, double *load_ns) {
+    ped_t *ped;
+    double start;
+
+    ped = ped_alloc();
+    ped_set_seed(ped, seed, 0);
+    start = now_ns();
+    if (ped_nodes_alloc(ped, pf->num_inds, num_samples) != 0
+            || ped_load(ped, pf->inds, pf->fathers, pf->mothers,
+                pf->num_inds) != 0) {
+        free_ped(ped);
+        return NULL;
+    }
+    *load_ns = now_ns() - start;
+
+    return ped;
+}
+
+static int bench_samples(ped_t *ped, const pedfile_t *pf, uint32_t last_size,
+        uint32_t num_samples, rng_t *rng) {
+    // Distinct samples drawn from the last generation, all heterozygotes
+    int ret = 0;
+    uint32_t i, j;
+    int *pool = NULL, *genotypes = NULL;
+    int tmp;
+
+    pool = malloc(last_size * sizeof(int));
+    genotypes = malloc(num_samples * sizeof(int));
+    if (pool == NULL || genotypes == NULL) {
+        ret = 1;
+        goto out;
+    }
+    for (i = 0; i < last_size; i++) {
+        pool[i] = pf->num_inds - last_size + i;
+    }
+    for (i = 0; i < num_samples; i++) {
+        j = i + rng_uniform_int(rng, last_size - i);
+        tmp = pool[i];
+        pool[i] = pool[j];
+        pool[j] = tmp;
+        genotypes[i] = 1;
+    }
+
+    ret = ped_samples_alloc(ped, num_samples);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = ped_load_samples_from_idx(ped, pool, genotypes, num_samples);
+out:
+    free(pool);
+    free(genotypes);
+    return ret;
+}
+
+static int bench_config(FILE *out, const pedgen_params_t *params,
+        const uint32_t *sample_counts, uint32_t num_sample_counts,
+        uint32_t reps) {
+    int ret = 0;
+    uint32_t i, r, steps, num_samples;
+    double start, load_ns;
+    pedfile_t pf = {0, 0, NULL, NULL, NULL};
+    ped_t *ped = NULL;
+    rng_t rng;
+    timings_t t = {0, 0, NULL};
+
+    // Stream 0 of the seed is used for the pedigree itself
+    rng_init(&rng, params->seed, 1);
+    ret = pedgen_generate(&pf, params);
+    if (ret != 0) {
+        goto out;
+    }
+
+    for (r = 0; r < reps; r++) {
+        ped = bench_load(&pf, 0, params->seed, &load_ns);
+        if (ped == NULL) {
+            ret = 1;
+            goto out;
+        }
+        free_ped(ped);
+        ped = NULL;
+        ret = timings_add(&t, load_ns);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    timings_report(out, &t, "load", params, 0, pf.num_inds);
+
+    for (i = 0; i < num_sample_counts; i++) {
+        num_samples = sample_counts[i];
+        if (num_samples > params->pop_size) {
+            fprintf(stderr, "Skipping %u samples, more than a generation\n",
+                    num_samples);
+            continue;
+        }
+        ped = bench_load(&pf, num_samples, params->seed, &load_ns);
+        if (ped == NULL) {
+            ret = 1;
+            goto out;
+        }
+        ret = bench_samples(ped, &pf, params->pop_size, num_samples, &rng);
+        if (ret != 0) {
+            goto out;
+        }
+
+        // Weights are zeroed between repeats so each does the same work
+        // as the first initialisation
+        for (r = 0; r < reps; r++) {
+            ret = ped_restart(ped);
+            ped_set_all_weights(ped, 0);
+            start = now_ns();
+            ret |= ped_init_sample_weights(ped);
+            ret |= timings_add(&t, now_ns() - start);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        timings_report(out, &t, "init_sample_weights", params, num_samples,
+                pf.num_inds);
+
+        for (r = 0; r < reps; r++) {
+            ret = ped_restart(ped);
+            while (ret == 0 && ped->num_active_lineages > 0) {
+                start = now_ns();
+                ret = ped_climb_step(ped);
+                ret |= timings_add(&t, now_ns() - start);
+            }
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        timings_report(out, &t, "climb_step", params, num_samples,
+                pf.num_inds);
+
+        for (r = 0; r < reps; r++) {
+            ret = ped_restart(ped);
+            if (ret != 0) {
+                goto out;
+            }
+            start = now_ns();
+            if (ped_simulate(ped, 0, &steps) != PED_SIMULATE_DONE) {
+                ret = 1;
+                goto out;
+            }
+            ret = timings_add(&t, now_ns() - start);
+            if (ret != 0) {
+                goto out;
+            }
+        }
+        timings_report(out, &t, "simulate", params, num_samples, pf.num_inds);
+
+        free_ped(ped);
+        ped = NULL;
+    }
+out:
+    if (ped != NULL) {
+        free_ped(ped);
+    }
+    pedfile_free(&pf);
+    free(t.ns);
+    return ret;
+}
+
+static uint32_t parse_list(char *arg, uint32_t *list) {
+    // Comma separated values, up to BENCH_MAX_CONFIGS of them
+    uint32_t n = 0;
+    char *tok;
+
+    for (tok = strtok(arg, ","); tok != NULL && n < BENCH_MAX_CONFIGS;
+            tok = strtok(NULL, ",")) {
+        list[n++] = strtoul(tok, NULL, 10);
+    }
+    return n;
+}
+
+static void usage(void) {
+    printf("Usage: bench [-o output] [-r reps] [-s seed] [-n pop_size]\n"
+            "             [-g generations,...] [-k samples,...]\n");
+}
+
+int main(int argc, char **argv) {
+    int ret = 0;
+    int opt;
+    uint32_t i, reps = 10;
+    uint32_t gens[BENCH_MAX_CONFIGS] = {5, 10, 20};
+    uint32_t sample_counts[BENCH_MAX_CONFIGS] = {10, 100, 1000};
+    uint32_t num_gens = 3, num_sample_counts = 3;
+    const char *path = "bench.tsv";
+    pedgen_params_t params;
+    FILE *out = NULL;
+
+    pedgen_params_init(&params);
+    params.pop_size = params.num_founders = 2000;
+    while ((opt = getopt(argc, argv, "o:r:s:n:g:k:h")) != -1) {
+        switch (opt) {
+            case 'o':
+                path = optarg;
+                break;
+            case 'r':
+                reps = strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                params.seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'n':
+                params.pop_size = params.num_founders = strtoul(optarg, NULL,
+                        10);
+                break;
+            case 'g':
+                num_gens = parse_list(optarg, gens);
+                break;
+            case 'k':
+                num_sample_counts = parse_list(optarg, sample_counts);
+                break;
+            default:
+                usage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    out = fopen(path, "w");
+    if (out == NULL) {
+        printf("Error - could not open %s\n", path);
+        return 1;
+    }
+    fprintf(out, "benchmark\tgenerations\tpop_size\tsamples\tnodes\tcount"
+            "\tmin_ns\tmedian_ns\tmean_ns\n");
+    for (i = 0; i < num_gens; i++) {
+        params.num_generations = gens[i];
+        ret = bench_config(out, &params, sample_counts, num_sample_counts,
+                reps);
+        if (ret != 0) {
+            printf("Error - benchmark failed at %u generations\n", gens[i]);
+            break;
+        }
+    }
+    fclose(out);
+
+    return ret;
+}
@@ -0,0 +1,44 @@
+#ifndef BITSET
+#define BITSET
+#include <stdint.h>
+
+// Packed sample sets, 64 samples per word. Bit i of word i / 64 is set when
+// sample i is a member of the set.
+#define BITSET_WORD_BITS 64
+
+static inline uint32_t bitset_num_words(uint32_t num_bits) {
+    return (num_bits + BITSET_WORD_BITS - 1) / BITSET_WORD_BITS;
+}
+
+static inline int bitset_test(const uint64_t *set, uint32_t bit) {
+    return (set[bit / BITSET_WORD_BITS] >> (bit % BITSET_WORD_BITS)) & 1;
+}
+
+static inline void bitset_set(uint64_t *set, uint32_t bit) {
+    set[bit / BITSET_WORD_BITS] |= (uint64_t) 1 << (bit % BITSET_WORD_BITS);
+}
+
+static inline void bitset_clear(uint64_t *set, uint32_t bit) {
+    set[bit / BITSET_WORD_BITS] &= ~((uint64_t) 1 << (bit % BITSET_WORD_BITS));
+}
+
+// Number of members in the set. __builtin_popcountll becomes a single popcnt
+// per word when built with make NATIVE=1 (or -mpopcnt), and the unrolled
+// loop gives the compiler independent accumulators to vectorize over.
+static inline uint32_t bitset_count(const uint64_t *set, uint32_t num_words) {
+    uint32_t i;
+    uint32_t c0 = 0, c1 = 0, c2 = 0, c3 = 0;
+
+    for (i = 0; i + 4 <= num_words; i += 4) {
+        c0 += __builtin_popcountll(set[i]);
+        c1 += __builtin_popcountll(set[i + 1]);
+        c2 += __builtin_popcountll(set[i + 2]);
+        c3 += __builtin_popcountll(set[i + 3]);
+    }
+    for (; i < num_words; i++) {
+        c0 += __builtin_popcountll(set[i]);
+    }
+
+    return c0 + c1 + c2 + c3;
+}
+#endif
@@ -0,0 +1,351 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "signal.h"
+#include "ensemble.h"
+
+void weight_stats_init(weight_stats_t *stats) {
+    stats->n = 0;
+    stats->max_logw = -INFINITY;
+    stats->sum = 0;
+    stats->sum_sq = 0;
+}
+
+void weight_stats_add(weight_stats_t *stats, double logw) {
+    double scale, w;
+
+    stats->n++;
+    if (logw == -INFINITY) {
+        // Zero weight - counts towards n but adds nothing to the sums
+        return;
+    }
+    if (logw > stats->max_logw) {
+        // Rescale the sums to the new maximum
+        scale = exp(stats->max_logw - logw);
+        stats->sum *= scale;
+        stats->sum_sq *= scale * scale;
+        stats->max_logw = logw;
+    }
+    w = exp(logw - stats->max_logw);
+    stats->sum += w;
+    stats->sum_sq += w * w;
+}
+
+double weight_stats_log_mean(weight_stats_t *stats) {
+    if (stats->n == 0) {
+        return NAN;
+    }
+    return stats->max_logw + log(stats->sum) - log(stats->n);
+}
+
+double weight_stats_log_variance(weight_stats_t *stats) {
+    // Log of the unbiased sample variance of the weights
+    double var;
+
+    if (stats->n < 2) {
+        return NAN;
+    }
+    var = (stats->sum_sq - stats->sum * stats->sum / stats->n) / (stats->n - 1);
+    if (var <= 0) {
+        return -INFINITY;
+    }
+    return 2 * stats->max_logw + log(var);
+}
+
+double weight_stats_ess(weight_stats_t *stats) {
+    // Kish effective sample size, (sum w)^2 / sum w^2
+    if (stats->sum_sq == 0) {
+        return 0;
+    }
+    return stats->sum * stats->sum / stats->sum_sq;
+}
+
+double weight_stats_rel_err(weight_stats_t *stats) {
+    // Standard error of the mean weight relative to the mean, which doesn't
+    // depend on max_logw
+    double var, mean;
+
+    if (stats->n < 2 || stats->sum == 0) {
+        return INFINITY;
+    }
+    mean = stats->sum / stats->n;
+    var = (stats->sum_sq - stats->sum * mean) / (stats->n - 1);
+    if (var <= 0) {
+        return 0;
+    }
+    return sqrt(var / stats->n) / mean;
+}
+
+int ensemble_alloc(ensemble_t *ensemble, ped_t *shared, uint32_t num_workers,
+        uint64_t seed) {
+    // shared must have its pedigree and samples loaded, and must not be
+    // changed or freed while the ensemble exists. Its stats are only
+    // written by ensemble_free. num_workers of 0 gives one per core.
+    int ret = 0;
+    uint32_t i;
+    long num_cores;
+    ensemble_worker_t *w;
+
+    if (num_workers == 0) {
+        num_cores = sysconf(_SC_NPROCESSORS_ONLN);
+        num_workers = num_cores > 0 ? num_cores : 1;
+    }
+    ensemble->shared = shared;
+    ensemble->num_workers = num_workers;
+    ensemble->replicates = NULL;
+    ensemble->seed = seed;
+    ensemble->target_ess = 0;
+    ensemble->target_rel_err = 0;
+    ensemble->stop = 0;
+    weight_stats_init(&ensemble->stats);
+    pthread_mutex_init(&ensemble->stats_lock, NULL);
+    ensemble->workers = calloc(num_workers, sizeof(ensemble_worker_t));
+    if (ensemble->workers == NULL) {
+        ensemble->num_workers = 0;
+        ret = 1;
+        goto out;
+    }
+
+    for (i = 0; i < num_workers; i++) {
+        w = &ensemble->workers[i];
+        w->ensemble = ensemble;
+        pthread_mutex_init(&w->lock, NULL);
+
+        w->ped = ped_alloc();
+        w->ped->arena_flags = shared->arena_flags;
+        ret = ped_share_topology(w->ped, shared);
+        if (ret != 0) {
+            goto out;
+        }
+        // The workers already keep every core busy between them
+        ped_set_num_threads(w->ped, 1);
+    }
+out:
+    return ret;
+}
+
+int ensemble_free(ensemble_t *ensemble) {
+    uint32_t i;
+
+    for (i = 0; i < ensemble->num_workers; i++) {
+        if (ensemble->workers[i].ped != NULL) {
+            // The work done on the shared ped's behalf counts towards it.
+            // This is merged here rather than by ensemble_run, which other
+            // ensembles over the same shared ped may be running at once.
+            stats_add(&ensemble->shared->stats,
+                    &ensemble->workers[i].ped->stats);
+            free_ped(ensemble->workers[i].ped);
+        }
+        pthread_mutex_destroy(&ensemble->workers[i].lock);
+    }
+    free(ensemble->workers);
+    ensemble->workers = NULL;
+    ensemble->num_workers = 0;
+    pthread_mutex_destroy(&ensemble->stats_lock);
+
+    return 0;
+}
+
+int ensemble_stop_at(ensemble_t *ensemble, double target_ess,
+        double target_rel_err) {
+    ensemble->target_ess = target_ess;
+    ensemble->target_rel_err = target_rel_err;
+
+    return 0;
+}
+
+static int ensemble_steal(ensemble_worker_t *thief) {
+    // Moves the top half of the largest range left among the other workers
+    // over to thief. Returns 0 once every worker has run dry.
+    ensemble_t *ensemble = thief->ensemble;
+    ensemble_worker_t *victim, *w;
+    uint32_t i, remaining, most, mid, end;
+
+    while (1) {
+        victim = NULL;
+        most = 0;
+        for (i = 0; i < ensemble->num_workers; i++) {
+            w = &ensemble->workers[i];
+            if (w == thief) {
+                continue;
+            }
+            pthread_mutex_lock(&w->lock);
+            remaining = w->end - w->next;
+            pthread_mutex_unlock(&w->lock);
+            if (remaining > most) {
+                most = remaining;
+                victim = w;
+            }
+        }
+        if (victim == NULL) {
+            return 0;
+        }
+
+        // The victim may have worked through its range since it was
+        // measured, in which case look again
+        pthread_mutex_lock(&victim->lock);
+        remaining = victim->end - victim->next;
+        mid = victim->next + remaining / 2;
+        end = victim->end;
+        if (remaining > 0) {
+            victim->end = mid;
+        }
+        pthread_mutex_unlock(&victim->lock);
+
+        if (remaining > 0) {
+            pthread_mutex_lock(&thief->lock);
+            thief->next = mid;
+            thief->end = end;
+            pthread_mutex_unlock(&thief->lock);
+            return 1;
+        }
+    }
+}
+
+static int ensemble_next_replicate(ensemble_worker_t *w, uint32_t *rep) {
+    int found = 0;
+
+    while (!found) {
+        pthread_mutex_lock(&w->lock);
+        if (w->next < w->end) {
+            *rep = w->next;
+            w->next++;
+            found = 1;
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        if (!found && !ensemble_steal(w)) {
+            break;
+        }
+    }
+
+    return found;
+}
+
+void replicate_record(replicate_t *rep, ped_t *ped, ped_t *shared) {
+    // Fills in the outcome of the simulation ped just finished, apart from
+    // num_steps. Peds sharing the pedigree of shared don't share its node
+    // numbering, so nodes are translated through shared.
+    uint32_t i;
+
+    rep->done = 1;
+    rep->loglik = ped->loglik;
+    rep->coal_node = ped_idx_from_node(shared, ped->last_coal_node);
+    rep->founder = ped_idx_from_node(shared, ped->last_founder);
+    rep->num_founders = 0;
+    for (i = 0; i < ped->num_samples; i++) {
+        if (ped->active_lineages[i].status == 'F') {
+            rep->num_founders++;
+        }
+    }
+}
+
+static int ensemble_run_replicate(ensemble_t *ensemble, ped_t *ped,
+        replicate_t *rep) {
+    int ret = 0;
+
+    ped_set_seed(ped, ensemble->seed, rep - ensemble->replicates);
+    // Only undoes what this worker's previous replicate changed
+    ret = ped_reset(ped);
+    if (ret != 0) {
+        goto out;
+    }
+
+    // Every step moves each active lineage up a generation, so lineages
+    // run out after at most max_gen + 1 steps and no bound is needed
+    if (ped_simulate(ped, 0, &rep->num_steps) != PED_SIMULATE_DONE) {
+        ret = 1;
+        goto out;
+    }
+
+    replicate_record(rep, ped, ensemble->shared);
+out:
+    return ret;
+}
+
+static int ensemble_add_replicate(ensemble_t *ensemble, replicate_t *rep) {
+    // Returns whether the ensemble should keep going
+    int keep_going;
+
+    pthread_mutex_lock(&ensemble->stats_lock);
+    weight_stats_add(&ensemble->stats, rep->loglik);
+    if (ensemble->target_ess > 0 &&
+            weight_stats_ess(&ensemble->stats) >= ensemble->target_ess) {
+        ensemble->stop = 1;
+    }
+    if (ensemble->target_rel_err > 0 &&
+            weight_stats_rel_err(&ensemble->stats) <= ensemble->target_rel_err) {
+        ensemble->stop = 1;
+    }
+    keep_going = !ensemble->stop;
+    pthread_mutex_unlock(&ensemble->stats_lock);
+
+    return keep_going;
+}
+
+static void *ensemble_worker_main(void *arg) {
+    ensemble_worker_t *w = arg;
+    replicate_t *rep;
+    uint32_t i;
+
+    while (w->ret == 0 && ensemble_next_replicate(w, &i)) {
+        rep = &w->ensemble->replicates[i];
+        w->ret = ensemble_run_replicate(w->ensemble, w->ped, rep);
+        if (w->ret != 0 || !ensemble_add_replicate(w->ensemble, rep)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+int ensemble_run(ensemble_t *ensemble, replicate_t *replicates,
+        uint32_t num_replicates) {
+    // Replicates start out split evenly between the workers, and a worker
+    // which finishes its share steals from the busiest of the others. Once
+    // a stopping target is met, replicates already started are finished
+    // and the rest are left with done set to 0.
+    int ret = 0;
+    uint32_t i, started;
+    ensemble_worker_t *w;
+
+    ensemble->replicates = replicates;
+    ensemble->stop = 0;
+    weight_stats_init(&ensemble->stats);
+    for (i = 0; i < num_replicates; i++) {
+        replicates[i].done = 0;
+    }
+    for (i = 0; i < ensemble->num_workers; i++) {
+        w = &ensemble->workers[i];
+        w->next = (uint64_t) num_replicates * i / ensemble->num_workers;
+        w->end = (uint64_t) num_replicates * (i + 1) / ensemble->num_workers;
+        w->ret = 0;
+    }
+
+    for (started = 0; started < ensemble->num_workers; started++) {
+        w = &ensemble->workers[started];
+        if (pthread_create(&w->thread, NULL, ensemble_worker_main, w) != 0) {
+            printf("Error - could not start ensemble worker %d\n", started);
+            ret = 1;
+            break;
+        }
+    }
+    // Workers which did start pick up the share of any that didn't
+    for (i = 0; i < started; i++) {
+        w = &ensemble->workers[i];
+        pthread_join(w->thread, NULL);
+        if (w->ret != 0) {
+            ret = w->ret;
+        }
+    }
+    if (started == 0) {
+        ret = 1;
+    }
+    ensemble->replicates = NULL;
+
+    return ret;
+}
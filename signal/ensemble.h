@@ -0,0 +1,80 @@
+#ifndef ENSEMBLE
+#define ENSEMBLE
+#include <stdint.h>
+#include <pthread.h>
+
+#include "signal.h"
+
+// Outcome of one complete simulation
+typedef struct {
+    double loglik;
+    uint32_t num_steps; // Steps taken by ped_simulate
+    uint32_t num_founders; // Lineages which reached a founder
+    // Indices of nodes as loaded, see ped_idx_from_node
+    int32_t coal_node; // Node of the last coalescence, or -1
+    int32_t founder; // Last founder reached, or -1
+    uint32_t done; // 0 if the ensemble stopped before running the replicate
+} replicate_t;
+
+// Streaming summary of importance sampling weights. Sums of weights are kept
+// relative to the largest log weight seen so far, so they can't overflow
+// however large or small the weights get.
+typedef struct {
+    uint32_t n;
+    double max_logw;
+    double sum; // Sum of exp(logw - max_logw)
+    double sum_sq; // Sum of exp(2 * (logw - max_logw))
+} weight_stats_t;
+
+struct ensemble_s;
+
+// Each worker thread simulates on its own ped, which shares the topology of
+// the ensemble's ped. Replicates next up to end belong to the worker, and
+// lock guards that range against workers stealing from it.
+typedef struct {
+    ped_t *ped;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    uint32_t next;
+    uint32_t end;
+    struct ensemble_s *ensemble;
+    int ret;
+} ensemble_worker_t;
+
+typedef struct ensemble_s {
+    ped_t *shared;
+    uint32_t num_workers;
+    ensemble_worker_t *workers;
+    replicate_t *replicates; // Output of the current ensemble_run
+    // Replicate i draws from stream i of seed, so its outcome doesn't
+    // depend on which worker runs it
+    uint64_t seed;
+
+    // Weights of the replicates run so far. Once the effective sample size
+    // reaches target_ess, or the relative error of the mean weight falls to
+    // target_rel_err, stop is set and no further replicates are started.
+    // Either target is ignored when 0.
+    pthread_mutex_t stats_lock;
+    weight_stats_t stats;
+    double target_ess;
+    double target_rel_err;
+    int stop;
+} ensemble_t;
+
+void weight_stats_init(weight_stats_t *stats);
+void weight_stats_add(weight_stats_t *stats, double logw);
+double weight_stats_log_mean(weight_stats_t *stats);
+double weight_stats_log_variance(weight_stats_t *stats);
+double weight_stats_ess(weight_stats_t *stats);
+double weight_stats_rel_err(weight_stats_t *stats);
+
+void replicate_record(replicate_t *rep, ped_t *ped, ped_t *shared);
+
+int ensemble_alloc(ensemble_t *ensemble, ped_t *shared, uint32_t num_workers,
+        uint64_t seed);
+int ensemble_run(ensemble_t *ensemble, replicate_t *replicates,
+        uint32_t num_replicates);
+int ensemble_stop_at(ensemble_t *ensemble, double target_ess,
+        double target_rel_err);
+int ensemble_free(ensemble_t *ensemble);
+#endif
@@ -0,0 +1,213 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "signal.h"
+#include "bitset.h"
+#include "graph.h"
+
+static inline uint32_t graph_adjacent(ped_t *ped, int direction, int32_t node,
+        int32_t parents[2], const int32_t **adj) {
+    // Points adj at the parents or offspring of node, and returns how many
+    // there are
+    uint32_t n = 0;
+
+    if (direction == GRAPH_ANCESTORS) {
+        if (ped->fathers[node] != -1) {
+            parents[n++] = ped->fathers[node];
+        }
+        if (ped->mothers[node] != -1) {
+            parents[n++] = ped->mothers[node];
+        }
+        *adj = parents;
+    } else {
+        n = ped->offspring_start[node + 1] - ped->offspring_start[node];
+        *adj = ped->offspring + ped->offspring_start[node];
+    }
+    return n;
+}
+
+static int graph_check_node(ped_t *ped, int32_t node) {
+    if (node < 0 || node >= ped->num_nodes) {
+        printf("Error - node %d is not in the pedigree\n", node);
+        return 1;
+    }
+    return 0;
+}
+
+int ped_graph_reach(ped_t *ped, int direction, const int32_t *sources,
+        uint32_t num_sources, int32_t *out, uint32_t *num_out) {
+    // Breadth first search from all the sources at once, writing each node
+    // reached to out exactly once, sources included. out doubles as the
+    // queue, so must have room for num_nodes.
+    int ret = 0;
+    uint32_t i, j, head, len, num_adj;
+    int32_t node;
+    int32_t parents[2];
+    const int32_t *adj;
+    uint64_t *visited = NULL;
+
+    visited = calloc(bitset_num_words(ped->num_nodes), sizeof(uint64_t));
+    if (visited == NULL) {
+        ret = 1;
+        goto out;
+    }
+
+    len = 0;
+    for (i = 0; i < num_sources; i++) {
+        node = sources[i];
+        ret = graph_check_node(ped, node);
+        if (ret != 0) {
+            goto out;
+        }
+        if (!bitset_test(visited, node)) {
+            bitset_set(visited, node);
+            out[len++] = node;
+        }
+    }
+
+    for (head = 0; head < len; head++) {
+        num_adj = graph_adjacent(ped, direction, out[head], parents, &adj);
+        for (j = 0; j < num_adj; j++) {
+            node = adj[j];
+            if (!bitset_test(visited, node)) {
+                bitset_set(visited, node);
+                out[len++] = node;
+            }
+        }
+    }
+    *num_out = len;
+out:
+    free(visited);
+    return ret;
+}
+
+static int graph_paths_add(graph_paths_t *paths, int32_t node, uint32_t length,
+        double count) {
+    int ret = 0;
+    uint32_t capacity;
+    int32_t *nodes;
+    uint32_t *lengths;
+    double *counts;
+
+    if (paths->len == paths->capacity) {
+        capacity = paths->capacity == 0 ? 1024 : 2 * paths->capacity;
+        nodes = realloc(paths->nodes, capacity * sizeof(int32_t));
+        if (nodes != NULL) {
+            paths->nodes = nodes;
+        }
+        lengths = realloc(paths->lengths, capacity * sizeof(uint32_t));
+        if (lengths != NULL) {
+            paths->lengths = lengths;
+        }
+        counts = realloc(paths->counts, capacity * sizeof(double));
+        if (counts != NULL) {
+            paths->counts = counts;
+        }
+        if (nodes == NULL || lengths == NULL || counts == NULL) {
+            ret = 1;
+            goto out;
+        }
+        paths->capacity = capacity;
+    }
+
+    paths->nodes[paths->len] = node;
+    paths->lengths[paths->len] = length;
+    paths->counts[paths->len] = count;
+    paths->len++;
+out:
+    return ret;
+}
+
+int ped_graph_paths(ped_t *ped, int direction, int32_t source,
+        graph_paths_t *paths) {
+    // Counts paths out of source one length at a time. Each layer holds the
+    // nodes at the end of a path of the current length, with the number of
+    // such paths ending there, so the work is bounded by the number of nodes
+    // times the depth of the pedigree rather than by the number of paths.
+    // Source itself is the only node at length 0.
+    int ret = 0;
+    uint32_t i, j, length, cur_len, next_len, num_adj;
+    int32_t node, child;
+    int32_t parents[2];
+    const int32_t *adj;
+    int32_t *cur = NULL, *next = NULL, *swap_nodes;
+    double *cur_count = NULL, *next_count = NULL, *swap_counts;
+    uint64_t *in_next = NULL;
+
+    memset(paths, 0, sizeof(graph_paths_t));
+    ret = graph_check_node(ped, source);
+    if (ret != 0) {
+        goto out;
+    }
+
+    cur = malloc(ped->num_nodes * sizeof(int32_t));
+    next = malloc(ped->num_nodes * sizeof(int32_t));
+    // Indexed by node, and only valid for the nodes of their layer
+    cur_count = malloc(ped->num_nodes * sizeof(double));
+    next_count = malloc(ped->num_nodes * sizeof(double));
+    in_next = calloc(bitset_num_words(ped->num_nodes), sizeof(uint64_t));
+    if (cur == NULL || next == NULL || cur_count == NULL || next_count == NULL
+            || in_next == NULL) {
+        ret = 1;
+        goto out;
+    }
+
+    cur[0] = source;
+    cur_count[source] = 1;
+    cur_len = 1;
+    length = 0;
+    while (cur_len > 0) {
+        next_len = 0;
+        for (i = 0; i < cur_len; i++) {
+            node = cur[i];
+            ret = graph_paths_add(paths, node, length, cur_count[node]);
+            if (ret != 0) {
+                goto out;
+            }
+
+            num_adj = graph_adjacent(ped, direction, node, parents, &adj);
+            for (j = 0; j < num_adj; j++) {
+                child = adj[j];
+                if (!bitset_test(in_next, child)) {
+                    bitset_set(in_next, child);
+                    next[next_len++] = child;
+                    next_count[child] = 0;
+                }
+                next_count[child] += cur_count[node];
+            }
+        }
+        for (i = 0; i < next_len; i++) {
+            bitset_clear(in_next, next[i]);
+        }
+
+        swap_nodes = cur;
+        cur = next;
+        next = swap_nodes;
+        swap_counts = cur_count;
+        cur_count = next_count;
+        next_count = swap_counts;
+        cur_len = next_len;
+        length++;
+    }
+out:
+    if (ret != 0) {
+        graph_paths_free(paths);
+    }
+    free(cur);
+    free(next);
+    free(cur_count);
+    free(next_count);
+    free(in_next);
+    return ret;
+}
+
+int graph_paths_free(graph_paths_t *paths) {
+    free(paths->nodes);
+    free(paths->lengths);
+    free(paths->counts);
+    memset(paths, 0, sizeof(graph_paths_t));
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#ifndef GRAPH
+#define GRAPH
+#include <stdint.h>
+
+#include "signal.h"
+
+// Traversals of the loaded pedigree, in node numbering (see
+// ped_node_from_idx). Parents are read from fathers and mothers, which are
+// already a CSR adjacency with a fixed stride of two, and offspring from
+// offspring_start and offspring.
+#define GRAPH_ANCESTORS 0
+#define GRAPH_DESCENDANTS 1
+
+// Every node reachable from a source along a given path length, with the
+// number of distinct paths of that length. A node reached along paths of
+// several lengths appears once per length.
+typedef struct {
+    uint32_t len;
+    uint32_t capacity;
+    int32_t *nodes;
+    uint32_t *lengths;
+    double *counts; // Doubles, since counts grow exponentially with inbreeding
+} graph_paths_t;
+
+int ped_graph_reach(ped_t *ped, int direction, const int32_t *sources,
+        uint32_t num_sources, int32_t *out, uint32_t *num_out);
+int ped_graph_paths(ped_t *ped, int direction, int32_t source,
+        graph_paths_t *paths);
+int graph_paths_free(graph_paths_t *paths);
+#endif
@@ -37,6 +37,28 @@ class Pedigree:
         probands = set(self.inds).difference(set(self.fathers))
         self.probands = probands.difference(set(self.mothers))
 
+        self._graph = None
+
+
+    def graph(self):
+        """
+        Returns a pysignal.cPed holding this pedigree, with nodes in the
+        same order as the rows of the file, for the native traversals. It
+        is built the first time it is needed.
+        """
+        if self._graph is None:
+            import pysignal
+            self._graph = pysignal.cPed()
+            try:
+                self._graph.load_pedfile(self.pedfile, 0)
+            except IOError:
+                ## The C parser needs parents defined before their
+                ## offspring, which genfromtxt doesn't, so unsorted files
+                ## are loaded from the rows already read instead
+                self._graph.load_ped(pysignal.sort_ped(self), 0)
+
+        return self._graph
+
 
     def ordered_lineage(self, ind):
         """
@@ -44,30 +66,16 @@ class Pedigree:
         each lineage connecting to them
         """
         ordered_lineage = defaultdict(list)
-        indnum = self.ind_dict[ind]
-        current_generation = [self.mothers[indnum], self.fathers[indnum]]
+        nodes, lengths, counts = self.graph().ancestor_paths(self.ind_dict[ind])
 
-        if current_generation[0] == current_generation[1] == 0:
+        ## The first node is ind itself, at length 0
+        if len(nodes) == 1:
             ordered_lineage[0].append(0)
             return ordered_lineage
 
-        i = 0
-
-        while len(current_generation) > 0:
-            i += 1
-            next_generation = []
-            for ind in current_generation:
-                ## If there are multiple paths, we save both lengths in the list
-                ordered_lineage[ind].append(i)
-
-            for ancestor in current_generation:
-                indnum = self.ind_dict[ancestor]
-                if self.mothers[indnum] != 0:
-                    next_generation.append(self.mothers[indnum])
-                if self.fathers[indnum] != 0:
-                    next_generation.append(self.fathers[indnum])
-
-            current_generation = next_generation
+        for node, length, count in zip(nodes[1:], lengths[1:], counts[1:]):
+            ## If there are multiple paths, we save both lengths in the list
+            ordered_lineage[self.inds[node]].extend([int(length)] * int(count))
 
         return ordered_lineage
 
@@ -75,18 +83,9 @@ class Pedigree:
     def getlineage(self, ind):
         """
         Returns all the ancestors of an individual, including themselves,
-        in a single list
+        in a single list with each listed once
         """
-        lineage = [ind]
-        father, mother = self.parent_dict[ind]
-
-        if father != 0:
-            lineage.extend(self.getlineage(father))
-
-        if mother != 0:
-            lineage.extend(self.getlineage(mother))
-
-        return lineage
+        return list(self.inds[self.graph().ancestors(self.ind_dict[ind])])
 
 
     def ordered_descendants(self, ind):
@@ -98,20 +97,11 @@ class Pedigree:
             descendants[ind] = [path_length_1, path_length_2, ... ]
         """
         descendants = defaultdict(list)
-        descendants[ind] = [0]
-        currentgen = self.offspring_dict[ind]
-
-        i = 0
-        while len(currentgen) > 0:
-            i += 1
-            nextgen = []
-            for ind in currentgen:
-                ## If there are multiple paths, we save all lengths in the list
-                descendants[ind].append(i)
-            for offspring in currentgen:
-                nextgen.extend(self.offspring_dict[offspring])
-
-            currentgen = nextgen
+        nodes, lengths, counts = self.graph().descendant_paths(self.ind_dict[ind])
+
+        for node, length, count in zip(nodes, lengths, counts):
+            ## If there are multiple paths, we save all lengths in the list
+            descendants[self.inds[node]].extend([int(length)] * int(count))
 
         return dict(descendants)
 
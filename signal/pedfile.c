@@ -0,0 +1,355 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "signal.h"
+#include "pedfile.h"
+
+// Bytes read from the file at a time. No line may be longer than this.
+#define PEDFILE_CHUNK (1 << 20)
+
+// Open addressing map from individual ID to row, with linear probing.
+// Slots are empty where rows is -1, and the table is kept at most half full.
+typedef struct {
+    uint32_t capacity; // Always a power of 2
+    uint32_t size;
+    int32_t *keys;
+    int32_t *rows;
+} idmap_t;
+
+static int idmap_alloc(idmap_t *map, uint32_t capacity) {
+    uint32_t i;
+
+    map->capacity = capacity;
+    map->size = 0;
+    map->keys = malloc(capacity * sizeof(int32_t));
+    map->rows = malloc(capacity * sizeof(int32_t));
+    if (map->keys == NULL || map->rows == NULL) {
+        return 1;
+    }
+    for (i = 0; i < capacity; i++) {
+        map->rows[i] = -1;
+    }
+    return 0;
+}
+
+static void idmap_free(idmap_t *map) {
+    free(map->keys);
+    free(map->rows);
+    map->keys = NULL;
+    map->rows = NULL;
+}
+
+static uint32_t idmap_slot(idmap_t *map, int32_t key) {
+    // Fibonacci hashing spreads consecutive IDs across the table
+    uint32_t h = (uint32_t) key * UINT32_C(2654435769);
+
+    return (h ^ (h >> 16)) & (map->capacity - 1);
+}
+
+static int32_t idmap_find(idmap_t *map, int32_t key) {
+    uint32_t slot = idmap_slot(map, key);
+
+    while (map->rows[slot] != -1) {
+        if (map->keys[slot] == key) {
+            return map->rows[slot];
+        }
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    return -1;
+}
+
+static int idmap_insert(idmap_t *map, int32_t key, int32_t row) {
+    // Key must not already be in the map
+    int ret = 0;
+    uint32_t i, slot;
+    idmap_t bigger;
+
+    if (2 * (map->size + 1) > map->capacity) {
+        ret = idmap_alloc(&bigger, 2 * map->capacity);
+        if (ret != 0) {
+            idmap_free(&bigger);
+            goto out;
+        }
+        for (i = 0; i < map->capacity; i++) {
+            if (map->rows[i] != -1) {
+                idmap_insert(&bigger, map->keys[i], map->rows[i]);
+            }
+        }
+        idmap_free(map);
+        *map = bigger;
+    }
+
+    slot = idmap_slot(map, key);
+    while (map->rows[slot] != -1) {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+    map->keys[slot] = key;
+    map->rows[slot] = row;
+    map->size++;
+out:
+    return ret;
+}
+
+static int pedfile_grow(pedfile_t *pf) {
+    int ret = 0;
+    uint32_t capacity;
+    int32_t *inds, *fathers, *mothers;
+
+    capacity = pf->capacity == 0 ? 1024 : 2 * pf->capacity;
+    inds = realloc(pf->inds, capacity * sizeof(int32_t));
+    if (inds != NULL) {
+        pf->inds = inds;
+    }
+    fathers = realloc(pf->fathers, capacity * sizeof(int32_t));
+    if (fathers != NULL) {
+        pf->fathers = fathers;
+    }
+    mothers = realloc(pf->mothers, capacity * sizeof(int32_t));
+    if (mothers != NULL) {
+        pf->mothers = mothers;
+    }
+    if (inds == NULL || fathers == NULL || mothers == NULL) {
+        ret = 1;
+        goto out;
+    }
+    pf->capacity = capacity;
+out:
+    return ret;
+}
+
+static int pedfile_parse_int(const char **pos, const char *end, int32_t *val) {
+    // Reads one whitespace-separated integer, leaving pos just after it
+    const char *p = *pos;
+    int64_t x = 0;
+    int neg = 0;
+    const char *digits;
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    if (p < end && *p == '-') {
+        neg = 1;
+        p++;
+    }
+    digits = p;
+    while (p < end && *p >= '0' && *p <= '9') {
+        x = 10 * x + (*p - '0');
+        if (x > INT32_MAX) {
+            return 1;
+        }
+        p++;
+    }
+    if (p == digits || (p < end && *p != ' ' && *p != '\t' && *p != '\r')) {
+        return 1;
+    }
+
+    *val = neg ? -x : x;
+    *pos = p;
+    return 0;
+}
+
+static int pedfile_add_line(pedfile_t *pf, idmap_t *map, const char *line,
+        const char *end, unsigned long line_num) {
+    int ret = 0;
+    const char *p = line;
+    int32_t ind, father, mother, father_row, mother_row;
+
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+        p++;
+    }
+    if (p == end || *p == '#') {
+        // Blank or comment line
+        goto out;
+    }
+
+    if (pedfile_parse_int(&p, end, &ind) != 0
+            || pedfile_parse_int(&p, end, &father) != 0
+            || pedfile_parse_int(&p, end, &mother) != 0) {
+        printf("Error - line %lu: expected Ind, Father and Mother IDs\n",
+                line_num);
+        ret = 1;
+        goto out;
+    }
+    if (ind == 0) {
+        printf("Error - line %lu: ID 0 is reserved for unknown parents\n",
+                line_num);
+        ret = 1;
+        goto out;
+    }
+    if (idmap_find(map, ind) != -1) {
+        printf("Error - line %lu: individual %d is defined twice\n",
+                line_num, ind);
+        ret = 1;
+        goto out;
+    }
+
+    father_row = mother_row = -1;
+    if (father != 0) {
+        father_row = idmap_find(map, father);
+        if (father_row == -1) {
+            printf("Error - line %lu: father %d of %d is not defined before them\n",
+                    line_num, father, ind);
+            ret = 1;
+            goto out;
+        }
+    }
+    if (mother != 0) {
+        mother_row = idmap_find(map, mother);
+        if (mother_row == -1) {
+            printf("Error - line %lu: mother %d of %d is not defined before them\n",
+                    line_num, mother, ind);
+            ret = 1;
+            goto out;
+        }
+    }
+
+    if (pf->num_inds == pf->capacity) {
+        ret = pedfile_grow(pf);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+    pf->inds[pf->num_inds] = ind;
+    pf->fathers[pf->num_inds] = father_row;
+    pf->mothers[pf->num_inds] = mother_row;
+    ret = idmap_insert(map, ind, pf->num_inds);
+    pf->num_inds++;
+out:
+    return ret;
+}
+
+int pedfile_read(pedfile_t *pf, const char *path) {
+    // Reads the file a chunk at a time, carrying any partial line at the
+    // end of a chunk over to the start of the next
+    int ret = 0;
+    FILE *f = NULL;
+    char *buf = NULL;
+    const char *start, *end, *nl;
+    size_t len, got;
+    unsigned long line_num = 0;
+    idmap_t map = {0, 0, NULL, NULL};
+
+    memset(pf, 0, sizeof(pedfile_t));
+    f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Error - could not open %s\n", path);
+        ret = 1;
+        goto out;
+    }
+    buf = malloc(PEDFILE_CHUNK);
+    if (buf == NULL || idmap_alloc(&map, 1024) != 0) {
+        ret = 1;
+        goto out;
+    }
+
+    len = 0;
+    while (1) {
+        got = fread(buf + len, 1, PEDFILE_CHUNK - len, f);
+        len += got;
+        end = buf + len;
+
+        start = buf;
+        while ((nl = memchr(start, '\n', end - start)) != NULL) {
+            line_num++;
+            // First line is the header
+            if (line_num > 1) {
+                ret = pedfile_add_line(pf, &map, start, nl, line_num);
+                if (ret != 0) {
+                    goto out;
+                }
+            }
+            start = nl + 1;
+        }
+
+        if (got == 0) {
+            if (ferror(f)) {
+                printf("Error - could not read %s\n", path);
+                ret = 1;
+                goto out;
+            }
+            // Last line has no newline
+            if (start < end && ++line_num > 1) {
+                ret = pedfile_add_line(pf, &map, start, end, line_num);
+            }
+            break;
+        }
+        if (start == buf && len == PEDFILE_CHUNK) {
+            printf("Error - line %lu is too long\n", line_num + 1);
+            ret = 1;
+            goto out;
+        }
+        len = end - start;
+        memmove(buf, start, len);
+    }
+out:
+    if (ret != 0) {
+        pedfile_free(pf);
+    }
+    idmap_free(&map);
+    free(buf);
+    if (f != NULL) {
+        fclose(f);
+    }
+    return ret;
+}
+
+int pedfile_write(const pedfile_t *pf, const char *path) {
+    // Writes the rows back out in the format pedfile_read takes
+    int ret = 0;
+    FILE *f = NULL;
+    uint32_t i;
+    int32_t father, mother;
+
+    f = fopen(path, "w");
+    if (f == NULL) {
+        printf("Error - could not open %s\n", path);
+        ret = 1;
+        goto out;
+    }
+    fprintf(f, "ind\tfather\tmother\n");
+    for (i = 0; i < pf->num_inds; i++) {
+        father = pf->fathers[i] == -1 ? 0 : pf->inds[pf->fathers[i]];
+        mother = pf->mothers[i] == -1 ? 0 : pf->inds[pf->mothers[i]];
+        fprintf(f, "%d\t%d\t%d\n", pf->inds[i], father, mother);
+    }
+    if (ferror(f)) {
+        printf("Error - could not write %s\n", path);
+        ret = 1;
+    }
+out:
+    if (f != NULL && fclose(f) != 0) {
+        ret = 1;
+    }
+    return ret;
+}
+
+int pedfile_free(pedfile_t *pf) {
+    free(pf->inds);
+    free(pf->fathers);
+    free(pf->mothers);
+    memset(pf, 0, sizeof(pedfile_t));
+
+    return 0;
+}
+
+int ped_load_pedfile(ped_t *ped, const char *path, int num_samples) {
+    // Takes the place of ped_nodes_alloc and ped_load, with nodes in the
+    // same order as the lines of the file
+    int ret = 0;
+    pedfile_t pf;
+
+    ret = pedfile_read(&pf, path);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = ped_nodes_alloc(ped, pf.num_inds, num_samples);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = ped_load(ped, pf.inds, pf.fathers, pf.mothers, pf.num_inds);
+out:
+    pedfile_free(&pf);
+    return ret;
+}
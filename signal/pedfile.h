@@ -0,0 +1,29 @@
+#ifndef PEDFILE
+#define PEDFILE
+#include <stdint.h>
+
+#include "signal.h"
+
+// Pedigree text files have a header line, then one individual per line as
+//
+//   Ind    Father    Mother    [other columns, ignored]
+//
+// with 0 for an unknown parent. Every parent must have its own line before
+// any of their offspring. Blank lines and lines starting with # are skipped,
+// as numpy.genfromtxt does.
+
+// Rows of a parsed file, with parents given as row indices, or -1 when
+// unknown, ready for ped_load
+typedef struct {
+    uint32_t num_inds;
+    uint32_t capacity;
+    int32_t *inds;
+    int32_t *fathers;
+    int32_t *mothers;
+} pedfile_t;
+
+int pedfile_read(pedfile_t *pf, const char *path);
+int pedfile_write(const pedfile_t *pf, const char *path);
+int pedfile_free(pedfile_t *pf);
+int ped_load_pedfile(ped_t *ped, const char *path, int num_samples);
+#endif
@@ -0,0 +1,216 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "rng.h"
+#include "pedfile.h"
+#include "pedgen.h"
+
+void pedgen_params_init(pedgen_params_t *params) {
+    memset(params, 0, sizeof(pedgen_params_t));
+    params->seed = 1;
+    params->num_generations = 10;
+    params->num_founders = 1000;
+    params->pop_size = 1000;
+    params->mating = PEDGEN_RANDOM_MATING;
+}
+
+static uint32_t pedgen_gen_size(const pedgen_params_t *params, uint32_t gen) {
+    if (gen == 0) {
+        return params->num_founders;
+    }
+    if (gen >= params->bottleneck_start
+            && gen - params->bottleneck_start < params->bottleneck_gens) {
+        return params->bottleneck_size;
+    }
+    return params->pop_size;
+}
+
+int pedgen_generate(pedfile_t *pf, const pedgen_params_t *params) {
+    // Fills pf with rows in generation order, so parents always come before
+    // their offspring. IDs are row numbers counting from 1.
+    int ret = 0;
+    rng_t rng;
+    uint32_t g, i, j, k, size, max_size, total, num_males, num_females;
+    uint32_t start, prev_start, grand_start, grand_size, num_couples;
+    int32_t father, mother, grandmother;
+    char *is_male = NULL, *paired = NULL;
+    int32_t *males = NULL, *females = NULL, *sisters = NULL;
+    uint32_t *sister_start = NULL;
+    int32_t *couple_fathers = NULL, *couple_mothers = NULL;
+
+    memset(pf, 0, sizeof(pedfile_t));
+    if (params->num_generations == 0) {
+        printf("Error - pedigree must have at least one generation\n");
+        ret = 1;
+        goto out;
+    }
+    total = max_size = 0;
+    for (g = 0; g < params->num_generations; g++) {
+        size = pedgen_gen_size(params, g);
+        // Everyone but the last generation needs someone to mate with
+        if (size < 2 && g + 1 < params->num_generations) {
+            printf("Error - generation %u has fewer than 2 individuals\n", g);
+            ret = 1;
+            goto out;
+        }
+        total += size;
+        max_size = size > max_size ? size : max_size;
+    }
+
+    pf->inds = malloc(total * sizeof(int32_t));
+    pf->fathers = malloc(total * sizeof(int32_t));
+    pf->mothers = malloc(total * sizeof(int32_t));
+    is_male = malloc(total * sizeof(char));
+    paired = calloc(total, sizeof(char));
+    males = malloc(max_size * sizeof(int32_t));
+    females = malloc(max_size * sizeof(int32_t));
+    sisters = malloc(max_size * sizeof(int32_t));
+    sister_start = malloc((max_size + 1) * sizeof(uint32_t));
+    couple_fathers = malloc(max_size * sizeof(int32_t));
+    couple_mothers = malloc(max_size * sizeof(int32_t));
+    if (pf->inds == NULL || pf->fathers == NULL
+            || pf->mothers == NULL || is_male == NULL || paired == NULL
+            || males == NULL || females == NULL || sisters == NULL
+            || sister_start == NULL || couple_fathers == NULL
+            || couple_mothers == NULL) {
+        ret = 1;
+        goto out;
+    }
+    rng_init(&rng, params->seed, 0);
+    pf->capacity = total;
+
+    start = prev_start = grand_start = 0;
+    grand_size = num_couples = 0;
+    for (g = 0; g < params->num_generations; g++) {
+        size = pedgen_gen_size(params, g);
+
+        if (g > 0) {
+            // Split the previous generation by sex, in random order
+            num_males = num_females = 0;
+            for (i = prev_start; i < start; i++) {
+                if (is_male[i]) {
+                    males[num_males++] = i;
+                } else {
+                    females[num_females++] = i;
+                }
+            }
+            for (i = num_males; i > 1; i--) {
+                j = rng_uniform_int(&rng, i);
+                father = males[i - 1];
+                males[i - 1] = males[j];
+                males[j] = father;
+            }
+            for (i = num_females; i > 1; i--) {
+                j = rng_uniform_int(&rng, i);
+                mother = females[i - 1];
+                females[i - 1] = females[j];
+                females[j] = mother;
+            }
+
+            // Group the females by their mother, who is in the generation
+            // before theirs, so a man's sisters are sisters[sister_start[m]]
+            // up to sister_start[m + 1] where m is his mother
+            memset(sister_start, 0, (grand_size + 1) * sizeof(uint32_t));
+            if (g > 1) {
+                for (i = 0; i < num_females; i++) {
+                    sister_start[pf->mothers[females[i]] - grand_start + 1]++;
+                }
+                for (i = 0; i < grand_size; i++) {
+                    sister_start[i + 1] += sister_start[i];
+                }
+                for (i = 0; i < num_females; i++) {
+                    k = pf->mothers[females[i]] - grand_start;
+                    sisters[sister_start[k]++] = females[i];
+                }
+                // Filling shifted every start up by one group
+                for (i = grand_size; i > 0; i--) {
+                    sister_start[i] = sister_start[i - 1];
+                }
+                sister_start[0] = 0;
+            }
+
+            if (params->mating == PEDGEN_MONOGAMY) {
+                num_couples = num_males < num_females ? num_males : num_females;
+            } else {
+                num_couples = size;
+            }
+            k = 0;
+            for (i = 0; i < num_couples; i++) {
+                if (params->mating == PEDGEN_MONOGAMY) {
+                    father = males[i];
+                } else {
+                    father = males[rng_uniform_int(&rng, num_males)];
+                }
+
+                mother = -1;
+                grandmother = pf->mothers[father];
+                if (grandmother != -1 && params->sib_mating > 0
+                        && rng_uniform(&rng) < params->sib_mating) {
+                    j = grandmother - grand_start;
+                    if (sister_start[j + 1] > sister_start[j]) {
+                        mother = sisters[sister_start[j] + rng_uniform_int(
+                                &rng, sister_start[j + 1] - sister_start[j])];
+                    }
+                    if (mother != -1 && params->mating == PEDGEN_MONOGAMY
+                            && paired[mother]) {
+                        mother = -1;
+                    }
+                }
+                if (mother == -1) {
+                    if (params->mating == PEDGEN_MONOGAMY) {
+                        // There are at least as many females as couples, so
+                        // one is always still single
+                        while (paired[females[k]]) {
+                            k++;
+                        }
+                        mother = females[k];
+                    } else {
+                        mother = females[rng_uniform_int(&rng, num_females)];
+                    }
+                }
+                paired[mother] = 1;
+                couple_fathers[i] = father;
+                couple_mothers[i] = mother;
+            }
+        }
+
+        for (i = start; i < start + size; i++) {
+            pf->inds[i] = i + 1;
+            pf->fathers[i] = pf->mothers[i] = -1;
+            if (g > 0) {
+                j = params->mating == PEDGEN_MONOGAMY
+                    ? rng_uniform_int(&rng, num_couples) : i - start;
+                pf->fathers[i] = couple_fathers[j];
+                pf->mothers[i] = couple_mothers[j];
+            }
+            is_male[i] = rng_uniform_int(&rng, 2);
+        }
+        // Make sure there is at least one of each
+        if (size >= 2) {
+            if (is_male[start] == is_male[start + 1]) {
+                is_male[start + 1] = !is_male[start];
+            }
+        }
+
+        grand_start = prev_start;
+        grand_size = start - prev_start;
+        prev_start = start;
+        start += size;
+        pf->num_inds = start;
+    }
+out:
+    if (ret != 0) {
+        pedfile_free(pf);
+    }
+    free(is_male);
+    free(paired);
+    free(males);
+    free(females);
+    free(sisters);
+    free(sister_start);
+    free(couple_fathers);
+    free(couple_mothers);
+    return ret;
+}
@@ -0,0 +1,31 @@
+#ifndef PEDGEN
+#define PEDGEN
+#include <stdint.h>
+
+#include "pedfile.h"
+
+// Values of pedgen_params_t.mating
+#define PEDGEN_RANDOM_MATING 0 // Every child has a random father and mother
+#define PEDGEN_MONOGAMY 1 // Each generation pairs off into couples for life
+
+// Synthetic pedigree with discrete generations. Generation 0 is the
+// founders, and everyone after has both parents in the generation before.
+typedef struct {
+    unsigned long seed;
+    uint32_t num_generations; // Including the founders
+    uint32_t num_founders;
+    uint32_t pop_size; // Individuals in each generation after the founders
+    int mating;
+    // Chance that a mother is chosen from among the father's sisters, which
+    // share his mother, whenever he has any
+    double sib_mating;
+    // Generations [bottleneck_start, bottleneck_start + bottleneck_gens)
+    // have bottleneck_size individuals instead of pop_size
+    uint32_t bottleneck_start;
+    uint32_t bottleneck_gens;
+    uint32_t bottleneck_size;
+} pedgen_params_t;
+
+void pedgen_params_init(pedgen_params_t *params);
+int pedgen_generate(pedfile_t *pf, const pedgen_params_t *params);
+#endif
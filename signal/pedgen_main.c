@@ -0,0 +1,77 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "pedfile.h"
+#include "pedgen.h"
+
+// Writes a synthetic pedigree file, for testing and benchmarking
+
+static void usage(void) {
+    printf("Usage: pedgen [-s seed] [-g generations] [-f founders] "
+            "[-n pop_size]\n"
+            "              [-m] [-i sib_mating] [-b start,gens,size] output\n"
+            "\n"
+            "  -m  monogamous couples rather than random mating\n"
+            "  -i  chance a father mates with one of his sisters\n"
+            "  -b  bottleneck of size individuals for gens generations\n");
+}
+
+int main(int argc, char **argv) {
+    int ret = 0;
+    int opt;
+    pedgen_params_t params;
+    pedfile_t pf = {0, 0, NULL, NULL, NULL};
+
+    pedgen_params_init(&params);
+    while ((opt = getopt(argc, argv, "s:g:f:n:mi:b:h")) != -1) {
+        switch (opt) {
+            case 's':
+                params.seed = strtoul(optarg, NULL, 10);
+                break;
+            case 'g':
+                params.num_generations = atoi(optarg);
+                break;
+            case 'f':
+                params.num_founders = atoi(optarg);
+                break;
+            case 'n':
+                params.pop_size = atoi(optarg);
+                break;
+            case 'm':
+                params.mating = PEDGEN_MONOGAMY;
+                break;
+            case 'i':
+                params.sib_mating = atof(optarg);
+                break;
+            case 'b':
+                if (sscanf(optarg, "%u,%u,%u", &params.bottleneck_start,
+                            &params.bottleneck_gens,
+                            &params.bottleneck_size) != 3) {
+                    usage();
+                    return 1;
+                }
+                break;
+            default:
+                usage();
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+    if (optind != argc - 1) {
+        usage();
+        return 1;
+    }
+
+    ret = pedgen_generate(&pf, &params);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = pedfile_write(&pf, argv[optind]);
+    if (ret != 0) {
+        goto out;
+    }
+    printf("Wrote %u individuals to %s\n", pf.num_inds, argv[optind]);
+out:
+    pedfile_free(&pf);
+    return ret;
+}
@@ -1,6 +1,8 @@
 import numpy as np
 cimport numpy as np
 
+np.import_array()
+
 
 def sort_ped(Ped):
     ninds = len(Ped.inds)
@@ -24,35 +26,290 @@ def sort_ped(Ped):
 
 
 ## References the functions defined in the header of the C library
+cdef extern from "trace.h":
+    ctypedef struct trace_event_t:
+        unsigned int seq
+        int lineage
+        int node
+        int parent
+        float mother_weight
+        float father_weight
+        unsigned char type
+
+    ctypedef struct trace_t:
+        pass
+
+    unsigned int trace_pending(trace_t *trace)
+    unsigned int trace_drain(trace_t *trace, trace_event_t *out,
+            unsigned int max_events)
+
+cdef extern from "arena.h":
+    ctypedef struct arena_t:
+        size_t size
+
+cdef extern from "stats.h":
+    ctypedef struct stats_t:
+        unsigned long long update_calls
+        unsigned long long update_nodes
+        unsigned long long update_ns
+        unsigned long long parent_weight_calls
+        unsigned long long parent_weight_nodes
+        unsigned long long parent_weight_depth
+        unsigned long long parent_weight_max_depth
+        unsigned long long parent_weight_ns
+        unsigned long long max_coal_calls
+        unsigned long long max_coal_repairs
+        unsigned long long climb_steps
+        unsigned long long climbs
+        unsigned long long climb_step_ns
+        unsigned long long init_calls
+        unsigned long long init_ns
+        unsigned long long restarts
+        unsigned long long resets
+        unsigned long long reset_nodes
+        int timers
+
+    void stats_reset(stats_t *stats)
+
+cdef extern from "rng.h":
+    ctypedef struct rng_t:
+        unsigned long long seed
+        unsigned long long stream
+
 cdef extern from "signal.h":
-    ## This sets the attributes accessible in the class attribute
-    ## of type node_t below
-    ctypedef struct node_t:
-        int ID
-        float weight
+    ctypedef struct lineage_t:
+        int idx
+        int node
+        char status
 
     ctypedef struct ped_t:
-        pass
+        unsigned int num_nodes
+        unsigned int num_samples
+        unsigned int num_sample_words
+        unsigned int num_active_lineages
+        int *node_idx
+        double *weights
+        signed char *genotypes
+        unsigned char *climb_state
+        unsigned long long *active_samples
+        lineage_t *active_lineages
+        trace_t trace
+        stats_t stats
+        rng_t rng
+        double pw_error
+        arena_t arena
+        size_t snapshot_size
 
     ## TODO: Double check int/uint casting here
     void multiply_by_10_in_C(double arr[], unsigned int n)
-    void print_node(node_t node) 
     ped_t *ped_alloc()
     int ped_nodes_alloc(ped_t *ped, int num_nodes, int num_samples)
+    int ped_use_huge_pages(ped_t *ped, int enable)
+    int ped_trace_enable(ped_t *ped, unsigned int capacity)
+    int ped_stats_enable_timers(ped_t *ped, int enable)
+    int ped_set_num_threads(ped_t *ped, int num_threads)
+    size_t ped_heap_bytes(ped_t *ped)
+    int ped_set_seed(ped_t *ped, unsigned long long seed,
+            unsigned long long stream)
+    unsigned long long ped_default_seed()
     int free_ped(ped_t *ped)
     int ped_load(ped_t *ped, int *inds, int *fathers, int *mothers, int num_inds)
+    int ped_load_pruned(ped_t *ped, int *inds, int *fathers, int *mothers,
+            int num_inds, int *samples_idx, int num_samples)
+    int ped_reorder_generations(ped_t *ped)
+    int ped_node_from_idx(ped_t *ped, int idx)
+    int ped_idx_from_node(ped_t *ped, int node)
+    int ped_save_snapshot(ped_t *ped, const char *path, int flags)
+    int ped_load_mmap(ped_t *ped, const char *path, int num_samples)
     int ped_print_nodes(ped_t *ped)
     int ped_samples_alloc(ped_t *ped, int num_samples)
     int ped_load_samples_from_idx(ped_t *ped, int *samples_idx, int *genotypes, int num_samples)
     int ped_init_sample_weights(ped_t *ped)
+    int ped_reset(ped_t *ped)
     int ped_print_samples(ped_t *ped)
 
     int ped_set_all_weights(ped_t *ped, double val)
     double ped_get_node_weight_from_idx(ped_t *ped, int node_idx)
+    int ped_set_parent_weight_depth(ped_t *ped, unsigned int depth,
+            double tolerance)
     int update_parent_carrier_from_idx(ped_t *ped, int node_idx, int sample_idx)
     int update_parent_not_carrier_from_idx(ped_t *ped, int node_idx, int sample_idx)
 
     int ped_climb_step(ped_t *ped)
+    int ped_simulate(ped_t *ped, unsigned int max_steps, unsigned int *num_steps) nogil
+
+cdef extern from "ensemble.h":
+    ctypedef struct replicate_t:
+        double loglik
+        unsigned int num_steps
+        unsigned int num_founders
+        int coal_node
+        int founder
+        unsigned int done
+
+    ctypedef struct weight_stats_t:
+        unsigned int n
+
+    ctypedef struct ensemble_t:
+        weight_stats_t stats
+
+    void weight_stats_init(weight_stats_t *stats)
+    double weight_stats_log_mean(weight_stats_t *stats)
+    double weight_stats_log_variance(weight_stats_t *stats)
+    double weight_stats_ess(weight_stats_t *stats)
+    double weight_stats_rel_err(weight_stats_t *stats)
+
+    int ensemble_alloc(ensemble_t *ensemble, ped_t *shared,
+            unsigned int num_workers, unsigned long long seed)
+    int ensemble_run(ensemble_t *ensemble, replicate_t *replicates,
+            unsigned int num_replicates) nogil
+    int ensemble_stop_at(ensemble_t *ensemble, double target_ess,
+            double target_rel_err)
+    int ensemble_free(ensemble_t *ensemble)
+
+cdef extern from "variants.h":
+    ctypedef struct variants_t:
+        pass
+
+    int variants_alloc(variants_t *variants, ped_t *shared,
+            unsigned int batch_size, unsigned int max_samples,
+            unsigned long long seed)
+    int variants_run(variants_t *variants, const unsigned int *sample_start,
+            const int *samples_idx, const int *genotypes,
+            unsigned int num_variants, replicate_t *results) nogil
+    int variants_free(variants_t *variants)
+
+cdef extern from "pedfile.h":
+    ctypedef struct pedfile_t:
+        unsigned int num_inds
+        int *inds
+        int *fathers
+        int *mothers
+
+    int pedfile_read(pedfile_t *pf, const char *path)
+    int pedfile_write(const pedfile_t *pf, const char *path)
+    int pedfile_free(pedfile_t *pf)
+    int ped_load_pedfile(ped_t *ped, const char *path, int num_samples)
+
+cdef extern from "graph.h":
+    enum:
+        GRAPH_ANCESTORS
+        GRAPH_DESCENDANTS
+
+    ctypedef struct graph_paths_t:
+        unsigned int len
+        int *nodes
+        unsigned int *lengths
+        double *counts
+
+    int ped_graph_reach(ped_t *ped, int direction, const int *sources,
+            unsigned int num_sources, int *out, unsigned int *num_out)
+    int ped_graph_paths(ped_t *ped, int direction, int source,
+            graph_paths_t *paths)
+    int graph_paths_free(graph_paths_t *paths)
+
+cdef extern from "pedgen.h":
+    enum:
+        PEDGEN_RANDOM_MATING
+        PEDGEN_MONOGAMY
+
+    ctypedef struct pedgen_params_t:
+        unsigned long seed
+        unsigned int num_generations
+        unsigned int num_founders
+        unsigned int pop_size
+        int mating
+        double sib_mating
+        unsigned int bottleneck_start
+        unsigned int bottleneck_gens
+        unsigned int bottleneck_size
+
+    void pedgen_params_init(pedgen_params_t *params)
+    int pedgen_generate(pedfile_t *pf, const pedgen_params_t *params)
+
+
+def read_ped(path):
+    ## Native replacement for sort_ped, reading the Ind/Father/Mother file
+    ## directly rather than going through ped.Pedigree. Rows are
+    ## [ind, father_ix, mother_ix] in file order, with -1 for unknown parents.
+    cdef pedfile_t pf
+    cdef bytes c_path = path.encode('utf-8')
+    cdef int [:, ::1] rows
+    cdef unsigned int i
+
+    ret = pedfile_read(&pf, c_path)
+    if ret != 0:
+        raise IOError("Could not read pedigree " + path)
+
+    sorted_ped_arr = np.zeros((pf.num_inds, 3), dtype=np.int32)
+    rows = sorted_ped_arr
+    for i in range(pf.num_inds):
+        rows[i, 0] = pf.inds[i]
+        rows[i, 1] = pf.fathers[i]
+        rows[i, 2] = pf.mothers[i]
+    pedfile_free(&pf)
+
+    return sorted_ped_arr
+
+
+def generate_ped(path, generations=10, founders=1000, pop_size=1000,
+        monogamy=False, sib_mating=0, bottleneck=None, seed=1):
+    ## Writes a synthetic pedigree file which read_ped and ped.Pedigree can
+    ## load. bottleneck is (start, generations, size) if given. See pedgen.h.
+    cdef pedgen_params_t params
+    cdef pedfile_t pf
+    cdef bytes c_path = path.encode('utf-8')
+
+    pedgen_params_init(&params)
+    params.seed = seed
+    params.num_generations = generations
+    params.num_founders = founders
+    params.pop_size = pop_size
+    params.mating = PEDGEN_MONOGAMY if monogamy else PEDGEN_RANDOM_MATING
+    params.sib_mating = sib_mating
+    if bottleneck is not None:
+        params.bottleneck_start, params.bottleneck_gens, \
+                params.bottleneck_size = bottleneck
+
+    ret = pedgen_generate(&pf, &params)
+    if ret != 0:
+        raise ValueError("Could not generate pedigree")
+    ret = pedfile_write(&pf, c_path)
+    pedfile_free(&pf)
+    if ret != 0:
+        raise IOError("Could not write pedigree " + path)
+
+
+## Matches the layout of trace_event_t, which the memoryview in drain_trace
+## checks
+trace_dtype = np.dtype([('seq', np.uint32),
+                        ('lineage', np.int32),
+                        ('node', np.int32),
+                        ('parent', np.int32),
+                        ('mother_weight', np.float32),
+                        ('father_weight', np.float32),
+                        ('type', np.uint8)], align=True)
+
+## Names of the trace event types defined in trace.h
+trace_types = {1: 'climb', 2: 'choice', 3: 'coalesce', 4: 'founder',
+               5: 'homozygote'}
+
+## Matches the layout of replicate_t, which the memoryview in
+## run_replicates checks
+replicate_dtype = np.dtype([('loglik', np.float64),
+                            ('num_steps', np.uint32),
+                            ('num_founders', np.uint32),
+                            ('coal_node', np.int32),
+                            ('founder', np.int32),
+                            ('done', np.uint32)], align=True)
+
+lineage_dtype = np.dtype([('idx', np.int32),
+                          ('node', np.int32),
+                          ('status', 'S1')], align=True)
+
+## Columns of the matrix returned by cPed.simulate_variants
+variant_columns = ('loglik', 'num_steps', 'num_founders', 'coal_node',
+                   'founder')
 
 
 ## Functions alone can be used for operations that input
@@ -71,15 +328,42 @@ def py_multiply_by_10_in_C(arr) -> None:
     return arr
 
 
+cdef _add_weight_summary(dict results, weight_stats_t *stats):
+    ## Summary statistics run_replicates returns alongside the replicates
+    results['num_done'] = stats.n
+    results['log_mean'] = weight_stats_log_mean(stats)
+    results['log_variance'] = weight_stats_log_variance(stats)
+    results['ess'] = weight_stats_ess(stats)
+    results['rel_err'] = weight_stats_rel_err(stats)
+
+
+cdef class _ViewBase:
+    ## Base of the arrays cPed._view returns, which keeps the cPed alive and
+    ## counts the views of it still in use
+    cdef cPed owner
+    cdef bint by_sample
+
+    def __dealloc__(self):
+        if self.owner is not None:
+            self.owner.num_views -= 1
+            if self.by_sample:
+                self.owner.num_sample_views -= 1
+
+
 ## Classes best used when we need a persistent object to
 ## pass to functions/manipulate, and which uses a custom
 ## type that can't simply be referenced in Python
 cdef class cPed:
     cdef ped_t *ped
     cdef int ret
+    cdef int num_views
+    cdef int num_sample_views # Views with a row per sample
 
-    def __cinit__(self):
+    def __cinit__(self, huge_pages=False, seed=None, stream=0):
         self.ped = ped_alloc()
+        ped_use_huge_pages(self.ped, huge_pages)
+        if seed is not None:
+            ped_set_seed(self.ped, seed, stream)
 
 
     ## For this to work, the memory for the ped_t self.ped struct
@@ -91,6 +375,9 @@ cdef class cPed:
 
 
     def load_samples(self, sample_arr, genotypes_arr=None):
+        ## lineages_view keeps the number of samples it was made with, so
+        ## would read stale lineages after this
+        self._check_no_views(by_sample=True)
         num_samples = len(sample_arr)
         ret = ped_samples_alloc(self.ped, num_samples)
         if ret != 0:
@@ -110,6 +397,7 @@ cdef class cPed:
 
 
     def load_ped(self, ped_arr, num_samples):
+        self._check_no_views()
         num_nodes = len(ped_arr)
         ret = ped_nodes_alloc(self.ped, num_nodes, num_samples)
         if ret != 0:
@@ -141,6 +429,127 @@ cdef class cPed:
         else:
             print num_nodes, "individuals loaded"
 
+    def load_ped_pruned(self, ped_arr, samples):
+        ## Used in place of load_ped, keeping only the samples and their
+        ## ancestors. Other methods keep taking indices into ped_arr, and
+        ## get_node_weight returns nan for individuals that were pruned.
+        self._check_no_views()
+        ped_arr = np.ascontiguousarray(ped_arr, dtype=np.int32)
+        cdef int [::1] inds = np.ascontiguousarray(ped_arr[:, 0])
+        cdef int [::1] fathers = np.ascontiguousarray(ped_arr[:, 1])
+        cdef int [::1] mothers = np.ascontiguousarray(ped_arr[:, 2])
+        cdef int [::1] samples_idx = np.ascontiguousarray(samples,
+                dtype=np.int32)
+
+        ret = ped_load_pruned(self.ped, &inds[0], &fathers[0], &mothers[0],
+                ped_arr.shape[0], &samples_idx[0], samples_idx.shape[0])
+        if ret != 0:
+            ## Using this as generic error
+            raise MemoryError()
+
+        print ped_arr.shape[0], "individuals pruned to", self.num_nodes()
+
+    def load_pedfile(self, path, num_samples):
+        ## Used in place of load_ped, parsing the pedigree file in C
+        self._check_no_views()
+        cdef bytes c_path = path.encode('utf-8')
+
+        ret = ped_load_pedfile(self.ped, c_path, num_samples)
+        if ret != 0:
+            raise IOError("Could not load pedigree " + path)
+
+    def reorder_generations(self):
+        ## Renumbers the loaded pedigree so each generation is contiguous in
+        ## memory, with parents next to their offspring's parents. Indices
+        ## passed in and returned keep referring to the rows of the array
+        ## or file the pedigree was loaded from. Call before load_samples.
+        self._check_no_views()
+        ret = ped_reorder_generations(self.ped)
+        if ret != 0:
+            raise RuntimeError("Could not reorder pedigree")
+
+    def save_snapshot(self, path, gens=True):
+        ## Writes the loaded pedigree to a binary snapshot which
+        ## load_snapshot can map back in without parsing or copying
+        cdef bytes c_path = path.encode('utf-8')
+
+        ret = ped_save_snapshot(self.ped, c_path, 1 if gens else 0)
+        if ret != 0:
+            raise IOError("Could not write snapshot " + path)
+
+    def load_snapshot(self, path, num_samples):
+        ## Used in place of load_ped, with the pedigree arrays mapped
+        ## straight from a file written by save_snapshot
+        self._check_no_views()
+        cdef bytes c_path = path.encode('utf-8')
+
+        ret = ped_load_mmap(self.ped, c_path, num_samples)
+        if ret != 0:
+            raise IOError("Could not load snapshot " + path)
+
+    def num_nodes(self):
+        return self.ped.num_nodes
+
+    cdef int _node(self, idx) except -1:
+        node = ped_node_from_idx(self.ped, idx)
+        if node < 0 or node >= self.ped.num_nodes:
+            raise ValueError("Individual " + str(idx) + " is not in the pedigree")
+        return node
+
+    def _reach(self, int direction, idx):
+        cdef int [::1] sources = np.array([self._node(x) for x in
+            np.atleast_1d(idx)], dtype=np.int32)
+        cdef int [::1] out = np.zeros(max(self.ped.num_nodes, 1), dtype=np.int32)
+        cdef unsigned int num_out = 0
+        cdef unsigned int i
+
+        ret = ped_graph_reach(self.ped, direction, &sources[0],
+                sources.shape[0], &out[0], &num_out)
+        if ret != 0:
+            raise MemoryError()
+        for i in range(num_out):
+            out[i] = ped_idx_from_node(self.ped, out[i])
+
+        return np.asarray(out[:num_out]).copy()
+
+    def _paths(self, int direction, idx):
+        cdef graph_paths_t paths
+        cdef unsigned int i
+
+        ret = ped_graph_paths(self.ped, direction, self._node(idx), &paths)
+        if ret != 0:
+            raise MemoryError()
+        nodes = np.zeros(paths.len, dtype=np.int32)
+        lengths = np.zeros(paths.len, dtype=np.uint32)
+        counts = np.zeros(paths.len, dtype=np.float64)
+        for i in range(paths.len):
+            nodes[i] = ped_idx_from_node(self.ped, paths.nodes[i])
+            lengths[i] = paths.lengths[i]
+            counts[i] = paths.counts[i]
+        graph_paths_free(&paths)
+
+        return nodes, lengths, counts
+
+    def ancestors(self, idx):
+        ## Indices of every ancestor of the individual or individuals at
+        ## idx, including themselves, each listed once in breadth first order
+        return self._reach(GRAPH_ANCESTORS, idx)
+
+    def descendants(self, idx):
+        ## As ancestors, following offspring instead of parents. After
+        ## load_ped_pruned, only the descendants that were kept are found.
+        return self._reach(GRAPH_DESCENDANTS, idx)
+
+    def ancestor_paths(self, idx):
+        ## Returns (indices, lengths, counts), with counts[i] the number of
+        ## distinct paths of lengths[i] generations up from idx to
+        ## indices[i]. idx itself comes first, at length 0.
+        return self._paths(GRAPH_ANCESTORS, idx)
+
+    def descendant_paths(self, idx):
+        ## As ancestor_paths, following offspring instead of parents
+        return self._paths(GRAPH_DESCENDANTS, idx)
+
     ## Defining with cpdef (also regular def, which has more overhead) exposes
     ## the function to the Python API
     cpdef print_nodes(self):
@@ -155,6 +564,99 @@ cdef class cPed:
     cpdef get_node_weight(self, ind_idx):
         return ped_get_node_weight_from_idx(self.ped, ind_idx)
 
+    ## The views below are read-only numpy arrays over the ped's own
+    ## memory, so they follow the simulation as it runs without copying.
+    ## They are indexed by node, see node_indices, and each keeps the cPed
+    ## alive. Loading or reordering the pedigree frees that memory, so
+    ## raises while any view (or array derived from one) is still alive, and
+    ## loading samples raises while a view with a row per sample is.
+    cdef _view(self, void *data, int typenum, np.npy_intp rows,
+            np.npy_intp cols=0, bint by_sample=False):
+        cdef np.npy_intp shape[2]
+        cdef np.ndarray arr
+        cdef _ViewBase base
+
+        shape[0] = rows
+        shape[1] = cols
+        if data == NULL:
+            ## Nothing allocated yet
+            shape[0] = shape[1] = 0
+        arr = np.PyArray_SimpleNewFromData(2 if cols > 0 else 1, shape,
+                typenum, data)
+        np.PyArray_CLEARFLAGS(arr, np.NPY_ARRAY_WRITEABLE)
+        base = _ViewBase()
+        base.owner = self
+        base.by_sample = by_sample
+        self.num_views += 1
+        if by_sample:
+            self.num_sample_views += 1
+        np.set_array_base(arr, base)
+        return arr
+
+    cdef _check_no_views(self, bint by_sample=False):
+        cdef int num = self.num_sample_views if by_sample else self.num_views
+
+        if num > 0:
+            raise RuntimeError("%d views of the pedigree are still alive, "
+                    "del them before loading or reordering" % num)
+
+    def node_indices(self):
+        ## Index as loaded of each node, for mapping views back to the rows
+        ## of the pedigree, which differ after pruning or reordering
+        if self.ped.node_idx == NULL:
+            return np.arange(self.ped.num_nodes, dtype=np.int32)
+        return self._view(self.ped.node_idx, np.NPY_INT32,
+                self.ped.num_nodes)
+
+    def weights_view(self):
+        ## Weight of each node as stored, rather than the parent weight
+        ## get_node_weight sums over its ancestors
+        return self._view(self.ped.weights, np.NPY_FLOAT64, self.ped.num_nodes)
+
+    def genotypes_view(self):
+        return self._view(self.ped.genotypes, np.NPY_INT8, self.ped.num_nodes)
+
+    def climb_state_view(self):
+        ## Bit 1 is set once a lineage has climbed from the node to its
+        ## mother, and bit 2 once one has climbed to its father
+        return self._view(self.ped.climb_state, np.NPY_UINT8,
+                self.ped.num_nodes)
+
+    def samples_view(self):
+        ## Samples with a lineage through each node, as a row of 64 bit
+        ## words per node with sample i at bit i % 64 of word i / 64.
+        ## np.unpackbits(view.view(np.uint8), axis=1, bitorder='little')
+        ## gives a column per sample.
+        return self._view(self.ped.active_samples, np.NPY_UINT64,
+                self.ped.num_nodes, self.ped.num_sample_words)
+
+    def lineages_view(self):
+        ## Lineage of each sample as an array of lineage_dtype, where the
+        ## first num_active_lineages() are still climbing and status is
+        ## A (active), C (coalesced) or F (founder). Nodes are in node
+        ## numbering, like the other views.
+        assert lineage_dtype.itemsize == sizeof(lineage_t)
+        return self._view(self.ped.active_lineages, np.NPY_UINT8,
+                self.ped.num_samples * sizeof(lineage_t), 0,
+                True).view(lineage_dtype)
+
+    def num_active_lineages(self):
+        return self.ped.num_active_lineages
+
+    def set_parent_weight_depth(self, depth=16, tolerance=0):
+        ## Approximates parent weights by leaving out ancestors depth or
+        ## more generations up (16 is the default, and the most allowed).
+        ## With a tolerance above 0, each weight instead stops at the
+        ## shallowest depth whose error bound is within tolerance.
+        ret = ped_set_parent_weight_depth(self.ped, depth, tolerance)
+        if ret != 0:
+            raise ValueError("Invalid parent weight depth " + str(depth))
+
+    def parent_weight_error(self):
+        ## Bound on the error of the last weight computed, from the
+        ## ancestors left out
+        return self.ped.pw_error
+
     cpdef update_parent_carrier(self, ind_idx, sample_idx):
         update_parent_carrier_from_idx(self.ped, ind_idx, sample_idx)
 
@@ -164,5 +666,202 @@ cdef class cPed:
     cpdef climb_step(self):
         ped_climb_step(self.ped)
 
+    def set_seed(self, seed, stream=0):
+        ## Restarts the random numbers used by climb_step and simulate at
+        ## the beginning of the given stream of seed. Different streams of
+        ## the same seed are independent.
+        ped_set_seed(self.ped, seed, stream)
+
+    def get_seed(self):
+        ## Returns the (seed, stream) last set, or picked when the cPed was
+        ## created without one
+        return self.ped.rng.seed, self.ped.rng.stream
+
+    def trace(self, capacity=65536):
+        ## Records climbing events into a ring holding at least the last
+        ## capacity events, or stops recording if capacity is 0. Tracing is
+        ## compiled out of release builds, so this records nothing there.
+        ret = ped_trace_enable(self.ped, capacity)
+        if ret != 0:
+            raise MemoryError()
+
+    def drain_trace(self):
+        ## Removes and returns the events recorded since the last drain,
+        ## oldest first, as an array of trace_dtype
+        cdef trace_event_t[::1] events
+        cdef unsigned int n, i
+
+        n = trace_pending(&self.ped.trace)
+        out = np.zeros(n, dtype=trace_dtype)
+        if n > 0:
+            events = out
+            trace_drain(&self.ped.trace, &events[0], n)
+            for i in range(n):
+                events[i].node = ped_idx_from_node(self.ped, events[i].node)
+                events[i].parent = ped_idx_from_node(self.ped,
+                        events[i].parent)
+
+        return out
+
+    def set_num_threads(self, num_threads=0):
+        ## Threads used to initialise the sample weights of pedigrees with
+        ## more than 65536 nodes. 0 lets OpenMP choose, from
+        ## OMP_NUM_THREADS or the number of cores.
+        if ped_set_num_threads(self.ped, num_threads) != 0:
+            raise ValueError("Invalid number of threads")
+
+    def enable_timers(self, enable=True):
+        ## Times the calls counted by stats, at the cost of reading the
+        ## clock around each of them
+        ped_stats_enable_timers(self.ped, enable)
+
+    def stats(self, reset=False):
+        ## Counts of the work done since the ped was made or the counts were
+        ## last reset, including by run_replicates and simulate_variants,
+        ## with times in nanoseconds if enable_timers is on. Also gives the
+        ## bytes held in the arena, on the heap and by a mapped snapshot.
+        cdef dict out = self.ped.stats
+
+        del out['timers']
+        out['arena_bytes'] = self.ped.arena.size
+        out['heap_bytes'] = ped_heap_bytes(self.ped)
+        out['snapshot_bytes'] = self.ped.snapshot_size
+        if reset:
+            stats_reset(&self.ped.stats)
+
+        return out
+
+    def simulate(self, max_steps=0):
+        ## Climbs until every lineage has coalesced or reached a founder,
+        ## stopping early after max_steps steps if it isn't 0. Returns
+        ## whether the simulation finished, and the number of steps taken.
+        cdef unsigned int c_max_steps = max_steps
+        cdef unsigned int num_steps = 0
+
+        with nogil:
+            ret = ped_simulate(self.ped, c_max_steps, &num_steps)
+        if ret < 0:
+            raise RuntimeError("Simulation failed")
+
+        return ret == 0, num_steps
+
     cpdef init_sample_weights(self):
         ped_init_sample_weights(self.ped)
+
+    def reset(self):
+        ## Puts the samples back at the bottom of the pedigree with the
+        ## weights init_sample_weights gave them, undoing only the nodes the
+        ## last simulation changed
+        if ped_reset(self.ped) != 0:
+            raise RuntimeError("Reset failed")
+
+    def run_replicates(self, n, seed=None, num_threads=1, target_ess=0,
+            target_rel_err=0):
+        ## Runs up to n complete simulations from the loaded samples without
+        ## holding the GIL, stopping early once the effective sample size
+        ## reaches target_ess or the relative error of the mean weight falls
+        ## to target_rel_err (either ignored if 0). Returns a dict of
+        ## per-replicate arrays, where 'done' is 0 for replicates skipped by
+        ## stopping early and node indices are -1 where a replicate had no
+        ## coalescence or reached no founder, along with summary statistics
+        ## of the weights of the replicates which were run. Replicate i
+        ## draws from stream i of seed, so the results for a given seed are
+        ## the same whatever num_threads is. num_threads of 0 runs a thread
+        ## per core.
+        cdef ensemble_t ensemble
+        cdef unsigned int num_replicates = n
+        cdef replicate_t[::1] reps
+
+        if num_threads < 0:
+            raise ValueError("Invalid number of threads")
+
+        if seed is None:
+            seed = ped_default_seed()
+
+        out = np.zeros(n, dtype=replicate_dtype)
+        results = {name: out[name] for name in replicate_dtype.names}
+        if n == 0:
+            ## Same keys as any other run, summarising no weights
+            weight_stats_init(&ensemble.stats)
+            _add_weight_summary(results, &ensemble.stats)
+            return results
+        reps = out
+
+        ret = ensemble_alloc(&ensemble, self.ped, num_threads, seed)
+        if ret != 0:
+            ensemble_free(&ensemble)
+            raise MemoryError()
+        ensemble_stop_at(&ensemble, target_ess, target_rel_err)
+        with nogil:
+            ret = ensemble_run(&ensemble, &reps[0], num_replicates)
+
+        _add_weight_summary(results, &ensemble.stats)
+        ## Merges the workers' stats into self.ped, so is called with the GIL
+        ## held in case another thread is running on this pedigree too
+        ensemble_free(&ensemble)
+        if ret != 0:
+            ## Using this as generic error
+            raise MemoryError()
+
+        return results
+
+    def simulate_variants(self, samples, genotypes=None, batch_size=64,
+            seed=None):
+        ## Simulates each variant once over the loaded pedigree, where
+        ## samples[i] holds the sample indices of variant i and genotypes[i]
+        ## their genotypes (all heterozygotes if genotypes is None). Samples
+        ## loaded with load_samples are not used. Variants are run
+        ## batch_size at a time, each batch climbing together. Returns a
+        ## matrix with a row per variant and the columns in
+        ## variant_columns, where node indices are -1 if the variant had no
+        ## coalescence or reached no founder. Variant i draws from stream i
+        ## of seed, so results don't depend on batch_size.
+        cdef variants_t variants
+        cdef unsigned int num_variants = len(samples)
+        cdef unsigned int [::1] sample_start
+        cdef int [::1] samples_idx
+        cdef int [::1] c_genotypes
+        cdef replicate_t[::1] reps
+
+        if seed is None:
+            seed = ped_default_seed()
+
+        counts = np.array([len(x) for x in samples], dtype=np.uint32)
+        starts = np.zeros(num_variants + 1, dtype=np.uint32)
+        np.cumsum(counts, out=starts[1:])
+        sample_start = starts
+        ## One spare entry so the arrays can't be empty
+        samples_idx = np.concatenate([np.asarray(x, dtype=np.int32).ravel()
+            for x in samples] + [np.zeros(1, dtype=np.int32)])
+        if genotypes is None:
+            c_genotypes = np.ones(samples_idx.shape[0], dtype=np.int32)
+        else:
+            if [len(x) for x in genotypes] != list(counts):
+                raise ValueError("Each variant needs a genotype per sample")
+            c_genotypes = np.concatenate([np.asarray(x,
+                dtype=np.int32).ravel() for x in genotypes]
+                + [np.zeros(1, dtype=np.int32)])
+
+        out = np.zeros(num_variants, dtype=replicate_dtype)
+        if num_variants == 0:
+            return np.zeros((0, len(variant_columns)))
+        reps = out
+
+        max_samples = counts.max()
+        batch_size = max(1, min(batch_size, num_variants))
+        ret = variants_alloc(&variants, self.ped, batch_size, max_samples,
+                seed)
+        if ret == 0:
+            with nogil:
+                ret = variants_run(&variants, &sample_start[0],
+                        &samples_idx[0], &c_genotypes[0], num_variants,
+                        &reps[0])
+        ## Merges the slots' stats into self.ped under the GIL, as in
+        ## run_replicates
+        variants_free(&variants)
+        if ret != 0:
+            ## Using this as generic error
+            raise MemoryError()
+
+        return np.column_stack([out[name].astype(np.float64)
+            for name in variant_columns])
@@ -0,0 +1,63 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "rng.h"
+
+#define PHILOX_M0 UINT32_C(0xD2511F53)
+#define PHILOX_M1 UINT32_C(0xCD9E8D57)
+#define PHILOX_W0 UINT32_C(0x9E3779B9)
+#define PHILOX_W1 UINT32_C(0xBB67AE85)
+
+void philox4x32_10(const uint32_t ctr[4], const uint32_t key[2],
+        uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    uint32_t k0 = key[0], k1 = key[1];
+    uint64_t p0, p1;
+    int r;
+
+    for (r = 0; r < 10; r++) {
+        p0 = (uint64_t) PHILOX_M0 * c0;
+        p1 = (uint64_t) PHILOX_M1 * c2;
+        c0 = (uint32_t) (p1 >> 32) ^ c1 ^ k0;
+        c2 = (uint32_t) (p0 >> 32) ^ c3 ^ k1;
+        c1 = (uint32_t) p1;
+        c3 = (uint32_t) p0;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+    }
+    out[0] = c0;
+    out[1] = c1;
+    out[2] = c2;
+    out[3] = c3;
+}
+
+void rng_init(rng_t *rng, uint64_t seed, uint64_t stream) {
+    rng->seed = seed;
+    rng->stream = stream;
+    rng->counter = 0;
+    // Empty, so the first draw refills
+    rng->pos = RNG_BATCH;
+}
+
+void rng_refill(rng_t *rng) {
+    // Block i of a stream has counter (i, stream), in 32 bit words from
+    // least significant, and key seed. Each block gives two uniforms.
+    uint32_t i;
+    uint32_t ctr[4], key[2], out[4];
+
+    key[0] = (uint32_t) rng->seed;
+    key[1] = (uint32_t) (rng->seed >> 32);
+    ctr[2] = (uint32_t) rng->stream;
+    ctr[3] = (uint32_t) (rng->stream >> 32);
+    for (i = 0; i < RNG_BATCH / 2; i++) {
+        ctr[0] = (uint32_t) rng->counter;
+        ctr[1] = (uint32_t) (rng->counter >> 32);
+        philox4x32_10(ctr, key, out);
+        rng->buf[2 * i] = ((((uint64_t) out[1] << 32) | out[0]) >> 11)
+            * 0x1.0p-53;
+        rng->buf[2 * i + 1] = ((((uint64_t) out[3] << 32) | out[2]) >> 11)
+            * 0x1.0p-53;
+        rng->counter++;
+    }
+    rng->pos = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef RNG
+#define RNG
+#include <stdint.h>
+
+// Counter-based generator, Philox4x32-10 (Salmon et al. 2011). Each draw is
+// a pure function of the seed, the stream and its position in the stream,
+// so any number of streams can be run from the same seed independently and
+// reproducibly, e.g. one per replicate. Uniforms are generated a batch at
+// a time into buf, which keeps the bijection out of the inner loops and
+// lets the compiler vectorize it.
+#define RNG_BATCH 64 // Uniforms per refill, two per Philox block
+
+typedef struct {
+    uint64_t seed;
+    uint64_t stream;
+    uint64_t counter; // Next block of the stream to generate
+    uint32_t pos; // Next unused uniform in buf
+    double buf[RNG_BATCH];
+} rng_t;
+
+void rng_init(rng_t *rng, uint64_t seed, uint64_t stream);
+void rng_refill(rng_t *rng);
+void philox4x32_10(const uint32_t ctr[4], const uint32_t key[2],
+        uint32_t out[4]);
+
+// Uniform on [0, 1), with 53 random bits
+static inline double rng_uniform(rng_t *rng) {
+    if (rng->pos == RNG_BATCH) {
+        rng_refill(rng);
+    }
+    return rng->buf[rng->pos++];
+}
+
+// Uniform on 0, ..., n - 1
+static inline uint32_t rng_uniform_int(rng_t *rng, uint32_t n) {
+    return (uint32_t) (rng_uniform(rng) * n);
+}
+#endif
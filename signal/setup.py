@@ -7,8 +7,9 @@ import numpy as np
 examples_extension = Extension(
     name="pysignal",
     sources=["pysignal.pyx"],
-    libraries=["signal", "gsl"],
+    libraries=["signal", "pthread", "m"],
     library_dirs=["."],
+    extra_link_args=["-fopenmp"],
     include_dirs=[np.get_include()]
 )
 setup(
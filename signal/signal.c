@@ -2,227 +2,1373 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stddef.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <assert.h>
-#include <gsl/gsl_rng.h>
-#include <gsl/gsl_minmax.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #include "signal.h"
+#include "bitset.h"
+#include "snapshot.h"
 
-int ped_alloc_rng(ped_t *ped) {
-    int ret = 0;
+static inline int32_t max_int(int32_t a, int32_t b) {
+    return a > b ? a : b;
+}
+
+static inline int32_t min_int(int32_t a, int32_t b) {
+    return a < b ? a : b;
+}
+
+// Counts the peds given a default seed, so that peds created at the same
+// moment still get different ones
+static uint64_t ped_seed_count = 0;
+
+int ped_set_seed(ped_t *ped, uint64_t seed, uint64_t stream) {
+    // Restarts the ped's random numbers at the beginning of the given
+    // stream. Peds with the same seed and stream draw the same numbers,
+    // and different streams of a seed are independent.
+    rng_init(&ped->rng, seed, stream);
+
+    return 0;
+}
+
+uint64_t ped_default_seed(void) {
+    // Clock time mixed with a process-wide count, for when no seed is given
     struct timespec ts;
-    gsl_rng * r;
+    uint64_t count;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    count = __atomic_fetch_add(&ped_seed_count, 1, __ATOMIC_RELAXED);
+
+    return ((uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec)
+        ^ (count * UINT64_C(0x9E3779B97F4A7C15));
+}
+
+void multiply_by_10_in_C(double arr[], unsigned int n)
+{
+    unsigned int i;
+    for (i = 0; i < n; i++) {
+        arr[i] *= 10;
+    }
+}
+
+ped_t * ped_alloc(void) {
+    int i;
+    static ped_t *ped;
+
+    // calloc leaves every array pointer NULL and every counter 0
+    ped = calloc(1, sizeof(ped_t));
+    assert(ped != NULL);
+    ped_set_seed(ped, ped_default_seed(), 0);
+    ped->scratch = &ped->own_scratch;
+
+    ped->pw_depth = PED_PARENT_WEIGHT_DEPTH;
+    for (i = 0; i < PED_PARENT_WEIGHT_DEPTH; i++) {
+        ped->pw_scale[i] = ldexp(1.0, -i);
+    }
+
+    return ped;
+}
+
+int ped_use_huge_pages(ped_t *ped, int enable) {
+    // Only takes effect for arenas allocated afterwards
+    if (enable) {
+        ped->arena_flags |= ARENA_HUGE_PAGES;
+    } else {
+        ped->arena_flags &= ~ARENA_HUGE_PAGES;
+    }
+
+    return 0;
+}
+
+int ped_set_num_threads(ped_t *ped, int num_threads) {
+    // 0 leaves the choice to OpenMP, which takes OMP_NUM_THREADS or else
+    // one thread per core
+    if (num_threads < 0) {
+        printf("Error - number of threads must not be negative\n");
+        return 1;
+    }
+    ped->num_threads = num_threads;
+
+    return 0;
+}
+
+int ped_trace_enable(ped_t *ped, uint32_t capacity) {
+    // Starts recording climbing events into a fresh ring of at least
+    // capacity events, or stops recording if capacity is 0. Does nothing
+    // when tracing is compiled out.
+    int ret = 0;
+
+#ifndef NDEBUG
+    if (capacity == 0) {
+        ped->trace.enabled = 0;
+        goto out;
+    }
+    ret = trace_alloc(&ped->trace, capacity);
+    if (ret != 0) {
+        goto out;
+    }
+    ped->trace.enabled = 1;
+out:
+#endif
+    return ret;
+}
+
+int ped_stats_enable_timers(ped_t *ped, int enable) {
+    // Timers read the clock around every counted call, so they are off
+    // unless asked for
+    ped->stats.timers = enable != 0;
+
+    return 0;
+}
+
+size_t ped_heap_bytes(ped_t *ped) {
+    // Bytes held outside the arena and any snapshot mapping
+    size_t bytes = sizeof(ped_t);
+
+    if (ped->own_scratch.update_head != NULL) {
+        bytes += (ped->max_gen + 1) * sizeof(int32_t);
+    }
+    if (ped->node_idx != NULL) {
+        bytes += ped->num_nodes * sizeof(int32_t);
+    }
+    if (ped->idx_node != NULL) {
+        bytes += ped->num_idx * sizeof(int32_t);
+    }
+    if (ped->trace.events != NULL) {
+        bytes += ped->trace.capacity * sizeof(trace_event_t);
+    }
+    bytes += (size_t) ped->own_scratch.pw_table_rows * PED_PARENT_WEIGHT_DEPTH
+        * sizeof(double);
+    bytes += (size_t) ped->journal_samples_capacity * ped->num_sample_words
+        * sizeof(uint64_t);
+
+    return bytes;
+}
+
+int free_ped(ped_t *ped) {
+    arena_free(&ped->arena);
+    if (ped->snapshot != NULL) {
+        munmap(ped->snapshot, ped->snapshot_size);
+    }
+    trace_free(&ped->trace);
+    free(ped->node_idx);
+    free(ped->idx_node);
+    free(ped->own_scratch.update_head);
+    free(ped->own_scratch.pw_table);
+    free(ped->journal_samples);
+    free(ped);
+
+    return 0;
+}
+
+// The arena layouts below are the arrays fixed once the pedigree and samples
+// are loaded, which workers made by ped_share_topology point into rather
+// than copy, and the arrays changed by a simulation
+
+static void ped_arena_layout_topology(ped_t *ped, arena_t *arena,
+        uint32_t num_nodes, uint32_t num_samples) {
+    size_t n = num_nodes;
+
+    ped->ids = arena_alloc(arena, n * sizeof(int32_t));
+    ped->fathers = arena_alloc(arena, n * sizeof(int32_t));
+    ped->mothers = arena_alloc(arena, n * sizeof(int32_t));
+    // Every node has at most two parents, so at most 2n offspring entries
+    ped->offspring_start = arena_alloc(arena, (n + 1) * sizeof(uint32_t));
+    ped->offspring = arena_alloc(arena, 2 * n * sizeof(int32_t));
+    ped->gens = arena_alloc(arena, n * sizeof(int32_t));
+    ped->gen_order = arena_alloc(arena, n * sizeof(int32_t));
+    // There are at most n generations
+    ped->gen_start = arena_alloc(arena, (n + 1) * sizeof(uint32_t));
+}
+
+static void ped_arena_layout_samples(ped_t *ped, arena_t *arena,
+        uint32_t num_nodes, uint32_t num_samples) {
+    ped->samples = arena_alloc(arena, num_samples * sizeof(int32_t));
+    ped->sample_genotypes = arena_alloc(arena, num_samples * sizeof(int8_t));
+}
+
+static void ped_arena_layout_slot(ped_t *ped, arena_t *arena,
+        uint32_t num_nodes, uint32_t num_samples) {
+    // The state of a single simulation, which is all a sparse ped has
+    size_t n = num_nodes;
+
+    ped->weights = arena_alloc(arena, n * sizeof(double));
+    ped->genotypes = arena_alloc(arena, n * sizeof(int8_t));
+    ped->climb_state = arena_alloc(arena, n * sizeof(uint8_t));
+    ped->active_samples = arena_alloc(arena,
+            n * bitset_num_words(num_samples) * sizeof(uint64_t));
+    ped->active_lineages = arena_alloc(arena, num_samples * sizeof(lineage_t));
+    ped->max_coal = arena_alloc(arena, n * sizeof(int32_t));
+    // A node is journaled at most once per replicate, so n entries is
+    // always enough
+    ped->journal_mark = arena_alloc(arena, n * sizeof(uint32_t));
+    ped->journal_nodes = arena_alloc(arena, n * sizeof(int32_t));
+}
+
+static void ped_arena_layout_scratch(ped_t *ped, arena_t *arena,
+        uint32_t num_nodes, uint32_t num_samples) {
+    size_t n = num_nodes;
+    ped_scratch_t *scratch = &ped->own_scratch;
+
+    scratch->coal_queued = arena_alloc(arena, n * sizeof(char));
+    scratch->coal_queue = arena_alloc(arena, n * sizeof(int32_t));
+    scratch->update_next = arena_alloc(arena, n * sizeof(int32_t));
+    scratch->update_queued = arena_alloc(arena, n * sizeof(char));
+    scratch->update_delta = arena_alloc(arena, n * sizeof(double));
+    scratch->pw_mark = arena_alloc(arena, n * sizeof(uint32_t));
+    scratch->pw_slot = arena_alloc(arena, n * sizeof(int32_t));
+    scratch->pw_cone = arena_alloc(arena, n * sizeof(int32_t));
+    scratch->pw_dist = arena_alloc(arena, n * sizeof(int32_t));
+}
+
+static void ped_arena_layout_state(ped_t *ped, arena_t *arena,
+        uint32_t num_nodes, uint32_t num_samples) {
+    size_t n = num_nodes;
+
+    ped_arena_layout_slot(ped, arena, num_nodes, num_samples);
+    ped->journal_weights = arena_alloc(arena, n * sizeof(double));
+    ped->journal_genotypes = arena_alloc(arena, n * sizeof(int8_t));
+    ped->journal_climb_state = arena_alloc(arena, n * sizeof(uint8_t));
+    ped->journal_max_coal = arena_alloc(arena, n * sizeof(int32_t));
+    ped_arena_layout_scratch(ped, arena, num_nodes, num_samples);
+}
+
+static void ped_arena_layout(ped_t *ped, arena_t *arena, uint32_t num_nodes,
+        uint32_t num_samples) {
+    ped_arena_layout_topology(ped, arena, num_nodes, num_samples);
+    ped_arena_layout_samples(ped, arena, num_nodes, num_samples);
+    ped_arena_layout_state(ped, arena, num_nodes, num_samples);
+}
+
+static void ped_arena_layout_mapped(ped_t *ped, arena_t *arena,
+        uint32_t num_nodes, uint32_t num_samples) {
+    // Topology comes from the snapshot, apart from generations if it
+    // doesn't have them, and the order they put nodes in
+    snapshot_header_t *header = (snapshot_header_t *) ped->snapshot;
+
+    if ((header->flags & SNAPSHOT_HAS_GENS) == 0) {
+        ped->gens = arena_alloc(arena, num_nodes * sizeof(int32_t));
+    }
+    ped->gen_order = arena_alloc(arena, num_nodes * sizeof(int32_t));
+    ped->gen_start = arena_alloc(arena, (num_nodes + 1) * sizeof(uint32_t));
+    ped_arena_layout_samples(ped, arena, num_nodes, num_samples);
+    ped_arena_layout_state(ped, arena, num_nodes, num_samples);
+}
+
+static int ped_arena_alloc(ped_t *ped, void (*layout)(ped_t *, arena_t *,
+            uint32_t, uint32_t)) {
+    // Measures the layout first, then maps exactly that much and lays it
+    // out for real
+    int ret = 0;
+    arena_t sizer = {NULL, 0, 0};
+
+    layout(ped, &sizer, ped->num_nodes, ped->max_samples);
+    arena_free(&ped->arena);
+    ret = arena_init(&ped->arena, sizer.used, ped->arena_flags);
+    if (ret != 0) {
+        goto out;
+    }
+    layout(ped, &ped->arena, ped->num_nodes, ped->max_samples);
+    // The new arena is zeroed, journal marks included, and journal entries
+    // may have changed size
+    ped->journal_epoch = 0;
+    ped->journal_epochs = 0;
+    free(ped->journal_samples);
+    ped->journal_samples = NULL;
+    ped->journal_samples_capacity = 0;
+out:
+    return ret;
+}
+
+static int ped_alloc_update_head(ped_t *ped) {
+    int ret = 0;
+    uint32_t i;
+
+    free(ped->scratch->update_head);
+    ped->scratch->update_head = malloc((ped->max_gen + 1) * sizeof(int32_t));
+    if (ped->scratch->update_head == NULL) {
+        ret = 1;
+        goto out;
+    }
+    for (i = 0; i <= ped->max_gen; i++) {
+        ped->scratch->update_head[i] = -1;
+    }
+out:
+    return ret;
+}
+
+static void ped_free_index(ped_t *ped) {
+    // Indices into one pedigree's arrays mean nothing for the next, so
+    // every load starts by dropping the maps
+    free(ped->node_idx);
+    free(ped->idx_node);
+    ped->node_idx = NULL;
+    ped->idx_node = NULL;
+    ped->num_idx = 0;
+}
+
+static void ped_free_snapshot(ped_t *ped) {
+    // Unmaps the snapshot a previous pedigree was loaded from, once
+    // nothing points into it
+    if (ped->snapshot != NULL) {
+        munmap(ped->snapshot, ped->snapshot_size);
+    }
+    ped->snapshot = NULL;
+    ped->snapshot_size = 0;
+}
+
+int ped_nodes_alloc(ped_t *ped, uint32_t num_nodes, int num_samples) {
+    int ret = 0;
+    int i;
+
+    ped_free_index(ped);
+    ped_free_snapshot(ped);
+
+    // Nothing downstream expects an empty pedigree, such as one read from a
+    // file with only a header
+    if (num_nodes == 0) {
+        printf("Error - pedigree has no individuals\n");
+        ret = 1;
+        goto out;
+    }
+    ped->num_nodes = num_nodes;
+    ped->num_sample_words = bitset_num_words(num_samples);
+    ped->max_samples = num_samples;
+
+    ret = ped_arena_alloc(ped, ped_arena_layout);
+    if (ret != 0) {
+        goto out;
+    }
+
+    for (i = 0; i < num_nodes; i++) {
+        ped->ids[i] = -1;
+        ped->fathers[i] = -1;
+        ped->mothers[i] = -1;
+    }
+out:
+    return ret;
+}
+
+int ped_samples_alloc(ped_t *ped, uint32_t num_samples) {
+    // Room for the samples and their lineages was set aside in the arena by
+    // ped_nodes_alloc
+    int ret = 0;
+
+    if (num_samples > ped->max_samples) {
+        printf("Error - arena only has room for %d samples\n", ped->max_samples);
+        ret = 1;
+        goto out;
+    }
+    ped->num_samples = num_samples;
+    ped->num_active_lineages = num_samples;
+out:
+    return ret;
+}
+
+static void ped_point_at_pedigree(ped_t *ped, ped_t *shared) {
+    ped->num_nodes = shared->num_nodes;
+    ped->sim_homs = shared->sim_homs;
+    ped->max_gen = shared->max_gen;
+    ped->pw_depth = shared->pw_depth;
+    ped->pw_tolerance = shared->pw_tolerance;
+    ped->num_threads = shared->num_threads;
+    ped->stats.timers = shared->stats.timers;
+
+    ped->ids = shared->ids;
+    ped->fathers = shared->fathers;
+    ped->mothers = shared->mothers;
+    ped->offspring_start = shared->offspring_start;
+    ped->offspring = shared->offspring;
+    ped->gens = shared->gens;
+    ped->gen_order = shared->gen_order;
+    ped->gen_start = shared->gen_start;
+}
+
+int ped_share_topology(ped_t *ped, ped_t *shared) {
+    // Points ped at the loaded pedigree and samples of shared, and gives it
+    // its own simulation state. Nothing in shared is written through ped,
+    // so any number of peds can share it from different threads, but
+    // shared must outlive them all.
+    int ret = 0;
+
+    ped_point_at_pedigree(ped, shared);
+    ped->num_samples = shared->num_samples;
+    ped->num_sample_words = shared->num_sample_words;
+    ped->max_samples = shared->max_samples;
+    ped->samples = shared->samples;
+    ped->sample_genotypes = shared->sample_genotypes;
+
+    ret = ped_arena_alloc(ped, ped_arena_layout_state);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = ped_alloc_update_head(ped);
+out:
+    return ret;
+}
+
+static void ped_arena_layout_sparse(ped_t *ped, arena_t *arena,
+        uint32_t num_nodes, uint32_t num_samples) {
+    ped_arena_layout_samples(ped, arena, num_nodes, num_samples);
+    ped_arena_layout_slot(ped, arena, num_nodes, num_samples);
+    if (ped->scratch == &ped->own_scratch) {
+        ped_arena_layout_scratch(ped, arena, num_nodes, num_samples);
+    }
+}
+
+int ped_share_pedigree(ped_t *ped, ped_t *shared, uint32_t max_samples,
+        ped_t *scratch) {
+    // As ped_share_topology, but only the pedigree is shared, and ped gets
+    // room for up to max_samples samples of its own, loaded with
+    // ped_load_samples_from_node. Node numbers are those of shared. ped is
+    // sparse, so only has the state of one simulation. If scratch is not
+    // NULL, ped uses its work space rather than having its own, which means
+    // scratch must outlive ped, the two must be stepped from the same
+    // thread, and each must finish its max_coal repairs, with
+    // ped_repair_max_coalescences, before the other is stepped.
+    int ret = 0;
+
+    ped_point_at_pedigree(ped, shared);
+    ped->num_samples = 0;
+    ped->num_active_lineages = 0;
+    ped->num_sample_words = bitset_num_words(max_samples);
+    ped->max_samples = max_samples;
+    ped->sparse = 1;
+    if (scratch != NULL) {
+        ped->scratch = scratch->scratch;
+    }
+
+    ret = ped_arena_alloc(ped, ped_arena_layout_sparse);
+    if (ret != 0) {
+        goto out;
+    }
+    if (scratch == NULL) {
+        ret = ped_alloc_update_head(ped);
+    }
+out:
+    return ret;
+}
+
+int ped_build_offspring(ped_t *ped) {
+    int ret = 0;
+    int i;
+    uint32_t *fill = NULL;
+
+    // Count offspring per parent, then prefix sum into start offsets
+    for (i = 0; i < ped->num_nodes; i++) {
+        if (ped->fathers[i] != -1) {
+            ped->offspring_start[ped->fathers[i] + 1]++;
+        }
+        if (ped->mothers[i] != -1) {
+            ped->offspring_start[ped->mothers[i] + 1]++;
+        }
+    }
+    for (i = 0; i < ped->num_nodes; i++) {
+        ped->offspring_start[i + 1] += ped->offspring_start[i];
+    }
+
+    fill = calloc(ped->num_nodes, sizeof(uint32_t));
+    if (fill == NULL) {
+        ret = 1;
+        goto out;
+    }
+    for (i = 0; i < ped->num_nodes; i++) {
+        if (ped->fathers[i] != -1) {
+            ped->offspring[ped->offspring_start[ped->fathers[i]]
+                + fill[ped->fathers[i]]++] = i;
+        }
+        if (ped->mothers[i] != -1) {
+            ped->offspring[ped->offspring_start[ped->mothers[i]]
+                + fill[ped->mothers[i]]++] = i;
+        }
+    }
+out:
+    free(fill);
+    return ret;
+}
+
+static int ped_build_gen_order(ped_t *ped) {
+    // Counting sort of the nodes by generation, deepest first
+    int ret = 0;
+    uint32_t i, g;
+    uint32_t *start = NULL;
+
+    start = calloc(ped->max_gen + 2, sizeof(uint32_t));
+    if (start == NULL) {
+        ret = 1;
+        goto out;
+    }
+    for (i = 0; i < ped->num_nodes; i++) {
+        start[ped->max_gen - ped->gens[i] + 1]++;
+    }
+    for (g = 0; g <= ped->max_gen; g++) {
+        start[g + 1] += start[g];
+    }
+    memcpy(ped->gen_start, start, (ped->max_gen + 2) * sizeof(uint32_t));
+    for (i = 0; i < ped->num_nodes; i++) {
+        ped->gen_order[start[ped->max_gen - ped->gens[i]]++] = i;
+    }
+out:
+    free(start);
+    return ret;
+}
+
+int ped_build_generations(ped_t *ped) {
+    // Topological sort from the founders down, using the number of parents
+    // not yet assigned a generation as the in-degree
+    int ret = 0;
+    uint32_t i, j, head, len;
+    int32_t n, child;
+    int32_t *order = NULL;
+    char *pending = NULL;
+
+    order = calloc(ped->num_nodes, sizeof(int32_t));
+    pending = calloc(ped->num_nodes, sizeof(char));
+    if (order == NULL || pending == NULL) {
+        ret = 1;
+        goto out;
+    }
+
+    len = 0;
+    for (i = 0; i < ped->num_nodes; i++) {
+        ped->gens[i] = 0;
+        pending[i] = (ped->fathers[i] != -1) + (ped->mothers[i] != -1);
+        if (pending[i] == 0) {
+            order[len++] = i;
+        }
+    }
+    ped->max_gen = 0;
+    for (head = 0; head < len; head++) {
+        n = order[head];
+        ped->max_gen = max_int(ped->max_gen, ped->gens[n]);
+        for (j = ped->offspring_start[n]; j < ped->offspring_start[n + 1]; j++) {
+            child = ped->offspring[j];
+            ped->gens[child] = max_int(ped->gens[child], ped->gens[n] + 1);
+            pending[child]--;
+            if (pending[child] == 0) {
+                order[len++] = child;
+            }
+        }
+    }
+    if (len != ped->num_nodes) {
+        printf("Error - pedigree contains a cycle\n");
+        ret = 1;
+        goto out;
+    }
+
+    ret = ped_build_gen_order(ped);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = ped_alloc_update_head(ped);
+out:
+    free(order);
+    free(pending);
+    return ret;
+}
+
+int ped_load(ped_t *ped, int *inds, int *fathers, int *mothers, int num_inds) {
+    int ret = 0;
+    int i;
+
+    for (i = 0; i < num_inds; i++) {
+        ped->ids[i] = inds[i];
+        ped->fathers[i] = fathers[i];
+        ped->mothers[i] = mothers[i];
+    }
+    ret = ped_build_offspring(ped);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = ped_build_generations(ped);
+out:
+    return ret;
+}
+
+int ped_node_from_idx(ped_t *ped, int idx) {
+    // Node for an index into the arrays the pedigree was loaded from, or -1
+    // if that individual was pruned away
+    if (ped->idx_node == NULL) {
+        return idx;
+    }
+    if (idx < 0 || idx >= ped->num_idx) {
+        return -1;
+    }
+    return ped->idx_node[idx];
+}
+
+int ped_idx_from_node(ped_t *ped, int node) {
+    if (ped->node_idx == NULL || node == -1) {
+        return node;
+    }
+    return ped->node_idx[node];
+}
+
+int ped_load_pruned(ped_t *ped, int *inds, int *fathers, int *mothers,
+        int num_inds, int *samples_idx, int num_samples) {
+    // Takes the place of ped_nodes_alloc and ped_load, keeping only the
+    // samples and their ancestors, since lineages can never climb anywhere
+    // else. Kept nodes are renumbered in their original order, so parents
+    // still come before offspring if they did before. The _from_idx
+    // functions keep taking indices into the original arrays.
+    int ret = 0;
+    int i, k, n, top, num_kept;
+    int32_t parents[2];
+    char *kept = NULL;
+    int32_t *stack = NULL;
+    int32_t *sub_inds = NULL, *sub_fathers = NULL, *sub_mothers = NULL;
+    int32_t *node_idx = NULL, *idx_node = NULL;
+
+    kept = calloc(num_inds, sizeof(char));
+    stack = malloc(num_inds * sizeof(int32_t));
+    idx_node = malloc(num_inds * sizeof(int32_t));
+    if (kept == NULL || stack == NULL || idx_node == NULL) {
+        ret = 1;
+        goto out;
+    }
+
+    // Depth-first walk up from the samples, marking each ancestor once
+    top = 0;
+    for (i = 0; i < num_samples; i++) {
+        if (samples_idx[i] < 0 || samples_idx[i] >= num_inds) {
+            printf("Error - sample %d is not in the pedigree\n", samples_idx[i]);
+            ret = 1;
+            goto out;
+        }
+        if (!kept[samples_idx[i]]) {
+            kept[samples_idx[i]] = 1;
+            stack[top++] = samples_idx[i];
+        }
+    }
+    while (top > 0) {
+        n = stack[--top];
+        parents[0] = fathers[n];
+        parents[1] = mothers[n];
+        for (k = 0; k < 2; k++) {
+            if (parents[k] != -1 && !kept[parents[k]]) {
+                kept[parents[k]] = 1;
+                stack[top++] = parents[k];
+            }
+        }
+    }
+
+    num_kept = 0;
+    for (i = 0; i < num_inds; i++) {
+        idx_node[i] = kept[i] ? num_kept++ : -1;
+    }
+    node_idx = malloc(num_kept * sizeof(int32_t));
+    sub_inds = malloc(num_kept * sizeof(int32_t));
+    sub_fathers = malloc(num_kept * sizeof(int32_t));
+    sub_mothers = malloc(num_kept * sizeof(int32_t));
+    if (node_idx == NULL || sub_inds == NULL || sub_fathers == NULL
+            || sub_mothers == NULL) {
+        ret = 1;
+        goto out;
+    }
+    for (i = 0; i < num_inds; i++) {
+        n = idx_node[i];
+        if (n == -1) {
+            continue;
+        }
+        // Parents of a kept node are always kept
+        node_idx[n] = i;
+        sub_inds[n] = inds[i];
+        sub_fathers[n] = fathers[i] == -1 ? -1 : idx_node[fathers[i]];
+        sub_mothers[n] = mothers[i] == -1 ? -1 : idx_node[mothers[i]];
+    }
+
+    ret = ped_nodes_alloc(ped, num_kept, num_samples);
+    if (ret != 0) {
+        goto out;
+    }
+    // Set after ped_nodes_alloc, which drops the maps of the last pedigree
+    ped->node_idx = node_idx;
+    ped->idx_node = idx_node;
+    ped->num_idx = num_inds;
+    node_idx = NULL;
+    idx_node = NULL;
+    ret = ped_load(ped, sub_inds, sub_fathers, sub_mothers, num_kept);
+out:
+    free(node_idx);
+    free(idx_node);
+    free(kept);
+    free(stack);
+    free(sub_inds);
+    free(sub_fathers);
+    free(sub_mothers);
+    return ret;
+}
+
+int ped_reorder_generations(ped_t *ped) {
+    // Renumbers the loaded nodes a generation at a time, from the deepest
+    // generation up to the founders, so that lineages climb steadily
+    // towards higher addresses. Within a generation, parents are numbered
+    // in the order of their offspring, so mates and the parents of siblings
+    // end up next to each other, followed by the nodes without offspring in
+    // their old order. The _from_idx functions keep taking indices into the
+    // arrays the pedigree was loaded from. Must be called before loading
+    // samples.
+    int ret = 0;
+    uint32_t i, g, pos;
+    int32_t n, k, parent;
+    int32_t *tmp;
+    int32_t parents[2];
+    uint32_t *level_start = NULL, *level_fill = NULL, *leaf_start = NULL;
+    int32_t *order = NULL, *perm = NULL, *leaves = NULL, *node_idx = NULL;
+    char *placed = NULL;
+
+    if (ped->snapshot != NULL) {
+        printf("Error - can't reorder a pedigree mapped from a snapshot\n");
+        ret = 1;
+        goto out;
+    }
+    if (ped->num_samples > 0) {
+        printf("Error - pedigree must be reordered before loading samples\n");
+        ret = 1;
+        goto out;
+    }
+
+    // Levels count generations up from the deepest, which is level 0
+    level_start = calloc(ped->max_gen + 2, sizeof(uint32_t));
+    level_fill = calloc(ped->max_gen + 1, sizeof(uint32_t));
+    leaf_start = calloc(ped->max_gen + 2, sizeof(uint32_t));
+    order = malloc(ped->num_nodes * sizeof(int32_t));
+    perm = malloc(ped->num_nodes * sizeof(int32_t));
+    leaves = malloc(ped->num_nodes * sizeof(int32_t));
+    placed = calloc(ped->num_nodes, sizeof(char));
+    if (level_start == NULL || level_fill == NULL || leaf_start == NULL
+            || order == NULL || perm == NULL || leaves == NULL
+            || placed == NULL) {
+        ret = 1;
+        goto out;
+    }
+
+    // Each level gets a contiguous range of order, and its nodes without
+    // offspring a contiguous range of leaves
+    for (i = 0; i < ped->num_nodes; i++) {
+        g = ped->max_gen - ped->gens[i];
+        level_start[g + 1]++;
+        if (ped->offspring_start[i] == ped->offspring_start[i + 1]) {
+            leaf_start[g + 1]++;
+        }
+    }
+    for (g = 0; g <= ped->max_gen; g++) {
+        level_start[g + 1] += level_start[g];
+        leaf_start[g + 1] += leaf_start[g];
+    }
+    for (i = 0; i < ped->num_nodes; i++) {
+        if (ped->offspring_start[i] == ped->offspring_start[i + 1]) {
+            g = ped->max_gen - ped->gens[i];
+            leaves[leaf_start[g] + level_fill[g]++] = i;
+        }
+    }
+    memset(level_fill, 0, (ped->max_gen + 1) * sizeof(uint32_t));
+
+    // Offspring are always on lower levels than their parents, so by the
+    // time a level is reached, every node on it with offspring has been
+    // placed by them
+    for (g = 0; g <= ped->max_gen; g++) {
+        for (pos = leaf_start[g]; pos < leaf_start[g + 1]; pos++) {
+            order[level_start[g] + level_fill[g]++] = leaves[pos];
+        }
+        for (pos = level_start[g]; pos < level_start[g + 1]; pos++) {
+            n = order[pos];
+            parents[0] = ped->fathers[n];
+            parents[1] = ped->mothers[n];
+            for (k = 0; k < 2; k++) {
+                parent = parents[k];
+                if (parent != -1 && !placed[parent]) {
+                    placed[parent] = 1;
+                    i = ped->max_gen - ped->gens[parent];
+                    order[level_start[i] + level_fill[i]++] = parent;
+                }
+            }
+        }
+    }
+    for (pos = 0; pos < ped->num_nodes; pos++) {
+        perm[order[pos]] = pos;
+    }
+
+    // Carry the maps to and from the original indices through perm
+    if (ped->idx_node == NULL) {
+        ped->idx_node = malloc(ped->num_nodes * sizeof(int32_t));
+        if (ped->idx_node == NULL) {
+            ret = 1;
+            goto out;
+        }
+        ped->num_idx = ped->num_nodes;
+        for (i = 0; i < ped->num_nodes; i++) {
+            ped->idx_node[i] = i;
+        }
+    }
+    for (i = 0; i < ped->num_idx; i++) {
+        if (ped->idx_node[i] != -1) {
+            ped->idx_node[i] = perm[ped->idx_node[i]];
+        }
+    }
+    node_idx = malloc(ped->num_nodes * sizeof(int32_t));
+    if (node_idx == NULL) {
+        ret = 1;
+        goto out;
+    }
+    for (pos = 0; pos < ped->num_nodes; pos++) {
+        node_idx[pos] = ped_idx_from_node(ped, order[pos]);
+    }
+    free(ped->node_idx);
+    ped->node_idx = node_idx;
+
+    // Permute the topology, with leaves as scratch now it's done with
+    tmp = leaves;
+
+    for (pos = 0; pos < ped->num_nodes; pos++) {
+        tmp[pos] = ped->ids[order[pos]];
+    }
+    memcpy(ped->ids, tmp, ped->num_nodes * sizeof(int32_t));
+    for (pos = 0; pos < ped->num_nodes; pos++) {
+        n = ped->fathers[order[pos]];
+        tmp[pos] = n == -1 ? -1 : perm[n];
+    }
+    memcpy(ped->fathers, tmp, ped->num_nodes * sizeof(int32_t));
+    for (pos = 0; pos < ped->num_nodes; pos++) {
+        n = ped->mothers[order[pos]];
+        tmp[pos] = n == -1 ? -1 : perm[n];
+    }
+    memcpy(ped->mothers, tmp, ped->num_nodes * sizeof(int32_t));
+    for (pos = 0; pos < ped->num_nodes; pos++) {
+        tmp[pos] = ped->gens[order[pos]];
+    }
+    memcpy(ped->gens, tmp, ped->num_nodes * sizeof(int32_t));
+
+    memset(ped->offspring_start, 0, (ped->num_nodes + 1) * sizeof(uint32_t));
+    ret = ped_build_offspring(ped);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = ped_build_gen_order(ped);
+    if (ret != 0) {
+        goto out;
+    }
+    ret = ped_clear_state(ped);
+out:
+    free(level_start);
+    free(level_fill);
+    free(leaf_start);
+    free(order);
+    free(perm);
+    free(leaves);
+    free(placed);
+    return ret;
+}
+
+static uint64_t snapshot_align(uint64_t offset) {
+    return (offset + SNAPSHOT_ALIGN - 1) & ~((uint64_t) SNAPSHOT_ALIGN - 1);
+}
+
+static int snapshot_write_array(FILE *f, uint64_t offset, const void *array,
+        size_t size) {
+    // Pads the file out to offset and writes the array there
+    long pos;
+
+    pos = ftell(f);
+    while (pos >= 0 && pos < offset) {
+        if (fputc(0, f) == EOF) {
+            return 1;
+        }
+        pos++;
+    }
+    if (pos < 0 || fwrite(array, 1, size, f) != size) {
+        return 1;
+    }
+    return 0;
+}
+
+int ped_save_snapshot(ped_t *ped, const char *path, int flags) {
+    // Writes the loaded pedigree in the format described in snapshot.h.
+    // Generations are only included if flags has SNAPSHOT_HAS_GENS. The
+    // maps from pruning or reordering are always included, so indices mean
+    // the same thing once the snapshot is loaded again.
+    int ret = 0;
+    FILE *f = NULL;
+    snapshot_header_t header;
+    size_t n = ped->num_nodes;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = SNAPSHOT_BYTE_ORDER;
+    header.flags = flags & SNAPSHOT_HAS_GENS;
+    if (ped->idx_node != NULL) {
+        header.flags |= SNAPSHOT_HAS_INDEX;
+        header.num_idx = ped->num_idx;
+    }
+    header.num_nodes = ped->num_nodes;
+    header.num_offspring = ped->offspring_start[n];
+    header.max_gen = ped->max_gen;
+    header.ids_offset = snapshot_align(sizeof(header));
+    header.fathers_offset = snapshot_align(header.ids_offset + n * sizeof(int32_t));
+    header.mothers_offset = snapshot_align(header.fathers_offset + n * sizeof(int32_t));
+    header.offspring_start_offset = snapshot_align(
+            header.mothers_offset + n * sizeof(int32_t));
+    header.offspring_offset = snapshot_align(
+            header.offspring_start_offset + (n + 1) * sizeof(uint32_t));
+    header.gens_offset = snapshot_align(
+            header.offspring_offset + header.num_offspring * sizeof(int32_t));
+    header.node_idx_offset = snapshot_align(header.gens_offset + n * sizeof(int32_t));
+    header.idx_node_offset = snapshot_align(
+            header.node_idx_offset + n * sizeof(int32_t));
+
+    f = fopen(path, "wb");
+    if (f == NULL) {
+        printf("Error - could not open %s for writing\n", path);
+        ret = 1;
+        goto out;
+    }
+    ret = snapshot_write_array(f, 0, &header, sizeof(header))
+        || snapshot_write_array(f, header.ids_offset, ped->ids,
+                n * sizeof(int32_t))
+        || snapshot_write_array(f, header.fathers_offset, ped->fathers,
+                n * sizeof(int32_t))
+        || snapshot_write_array(f, header.mothers_offset, ped->mothers,
+                n * sizeof(int32_t))
+        || snapshot_write_array(f, header.offspring_start_offset,
+                ped->offspring_start, (n + 1) * sizeof(uint32_t))
+        || snapshot_write_array(f, header.offspring_offset, ped->offspring,
+                header.num_offspring * sizeof(int32_t));
+    if (ret == 0 && (header.flags & SNAPSHOT_HAS_GENS)) {
+        ret = snapshot_write_array(f, header.gens_offset, ped->gens,
+                n * sizeof(int32_t));
+    }
+    if (ret == 0 && (header.flags & SNAPSHOT_HAS_INDEX)) {
+        ret = snapshot_write_array(f, header.node_idx_offset, ped->node_idx,
+                n * sizeof(int32_t))
+            || snapshot_write_array(f, header.idx_node_offset, ped->idx_node,
+                    header.num_idx * sizeof(int32_t));
+    }
+    if (ret != 0) {
+        printf("Error - could not write %s\n", path);
+    }
+out:
+    if (f != NULL && fclose(f) != 0) {
+        ret = 1;
+    }
+    return ret;
+}
+
+static int snapshot_check(snapshot_header_t *header, size_t size) {
+    // Checks that the header is one we can read and that every array lies
+    // inside the file. The arrays themselves are trusted.
+    uint64_t n;
+
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        printf("Error - not a pedigree snapshot\n");
+        return 1;
+    }
+    if (header->byte_order != SNAPSHOT_BYTE_ORDER) {
+        printf("Error - snapshot was written with a different byte order\n");
+        return 1;
+    }
+    if (header->version != SNAPSHOT_VERSION) {
+        printf("Error - unsupported snapshot version %d\n", header->version);
+        return 1;
+    }
 
-    r = gsl_rng_alloc(gsl_rng_taus);
-    if (r == NULL) {
+    n = header->num_nodes;
+    if (n == 0) {
+        printf("Error - pedigree has no individuals\n");
+        return 1;
+    }
+    if (header->ids_offset + n * sizeof(int32_t) > size
+            || header->fathers_offset + n * sizeof(int32_t) > size
+            || header->mothers_offset + n * sizeof(int32_t) > size
+            || header->offspring_start_offset + (n + 1) * sizeof(uint32_t) > size
+            || header->offspring_offset
+                + (uint64_t) header->num_offspring * sizeof(int32_t) > size
+            || ((header->flags & SNAPSHOT_HAS_GENS)
+                && header->gens_offset + n * sizeof(int32_t) > size)
+            || ((header->flags & SNAPSHOT_HAS_INDEX)
+                && (header->node_idx_offset + n * sizeof(int32_t) > size
+                    || header->idx_node_offset
+                        + (uint64_t) header->num_idx * sizeof(int32_t) > size))) {
+        printf("Error - snapshot is truncated\n");
+        return 1;
+    }
+
+    return 0;
+}
+
+int ped_load_mmap(ped_t *ped, const char *path, int num_samples) {
+    // Takes the place of ped_nodes_alloc and ped_load. The pedigree arrays
+    // are used in place from a read-only mapping of the snapshot, so the
+    // cost doesn't grow with the size of the pedigree unless generations
+    // have to be rebuilt.
+    int ret = 0;
+    int fd = -1;
+    struct stat st;
+    char *map = MAP_FAILED;
+    snapshot_header_t *header;
+
+    ped_free_index(ped);
+    fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        printf("Error - could not open %s\n", path);
+        ret = 1;
+        goto out;
+    }
+    if (fstat(fd, &st) != 0 || st.st_size < sizeof(snapshot_header_t)) {
+        printf("Error - not a pedigree snapshot\n");
+        ret = 1;
+        goto out;
+    }
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
         ret = 1;
         goto out;
     }
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    gsl_rng_set(r, (time_t)ts.tv_nsec);
-    printf("Random seed: %ld\n", (time_t)ts.tv_nsec);
+    header = (snapshot_header_t *) map;
+    ret = snapshot_check(header, st.st_size);
+    if (ret != 0) {
+        goto out;
+    }
 
-    ped->rng = r;
+    ped_free_snapshot(ped);
+    ped->snapshot = map;
+    ped->snapshot_size = st.st_size;
+    map = MAP_FAILED;
+
+    ped->num_nodes = header->num_nodes;
+    ped->num_sample_words = bitset_num_words(num_samples);
+    ped->max_samples = num_samples;
+    ped->ids = (int32_t *) (ped->snapshot + header->ids_offset);
+    ped->fathers = (int32_t *) (ped->snapshot + header->fathers_offset);
+    ped->mothers = (int32_t *) (ped->snapshot + header->mothers_offset);
+    ped->offspring_start = (uint32_t *) (ped->snapshot
+            + header->offspring_start_offset);
+    ped->offspring = (int32_t *) (ped->snapshot + header->offspring_offset);
+    if (header->flags & SNAPSHOT_HAS_GENS) {
+        ped->gens = (int32_t *) (ped->snapshot + header->gens_offset);
+        ped->max_gen = header->max_gen;
+    }
+    // The maps are copied rather than used in place, since
+    // ped_reorder_generations rewrites them and free_ped frees them
+    if (header->flags & SNAPSHOT_HAS_INDEX) {
+        ped->node_idx = malloc(ped->num_nodes * sizeof(int32_t));
+        ped->idx_node = malloc(header->num_idx * sizeof(int32_t));
+        if (ped->node_idx == NULL || ped->idx_node == NULL) {
+            ret = 1;
+            goto out;
+        }
+        memcpy(ped->node_idx, ped->snapshot + header->node_idx_offset,
+                ped->num_nodes * sizeof(int32_t));
+        memcpy(ped->idx_node, ped->snapshot + header->idx_node_offset,
+                header->num_idx * sizeof(int32_t));
+        ped->num_idx = header->num_idx;
+    }
+
+    ret = ped_arena_alloc(ped, ped_arena_layout_mapped);
+    if (ret != 0) {
+        goto out;
+    }
+    if (header->flags & SNAPSHOT_HAS_GENS) {
+        ret = ped_build_gen_order(ped);
+        if (ret != 0) {
+            goto out;
+        }
+        ret = ped_alloc_update_head(ped);
+    } else {
+        ret = ped_build_generations(ped);
+    }
 out:
+    if (map != MAP_FAILED) {
+        munmap(map, st.st_size);
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
     return ret;
 }
 
-void multiply_by_10_in_C(double arr[], unsigned int n)
-{
-    unsigned int i;
-    for (i = 0; i < n; i++) {
-        arr[i] *= 10;
+static void ped_drop_coal_queue(ped_t *ped) {
+    // Empties the queue without repairing anything
+    ped_scratch_t *scratch = ped->scratch;
+
+    while (scratch->coal_queue_len > 0) {
+        scratch->coal_queued[scratch->coal_queue[scratch->coal_queue_head]] = 0;
+        scratch->coal_queue_head = (scratch->coal_queue_head + 1) % ped->num_nodes;
+        scratch->coal_queue_len--;
     }
 }
 
-void print_node(node_t node) {
-    printf("%d\n", node.ID);
-    printf("%f\n", node.weight);
+static void ped_journal_open(ped_t *ped) {
+    // Marks from earlier journals are told apart by their epoch, so they
+    // only need clearing when the counter wraps
+    ped->journal_epochs++;
+    if (ped->journal_epochs == 0) {
+        memset(ped->journal_mark, 0, ped->num_nodes * sizeof(uint32_t));
+        ped->journal_epochs = 1;
+    }
+    ped->journal_epoch = ped->journal_epochs;
+    ped->journal_len = 0;
 }
 
-ped_t * ped_alloc(void) {
-    int ret = 0;
-    static ped_t *ped;
+static void ped_journal_add(ped_t *ped, int node) {
+    uint32_t num_words = ped->num_sample_words;
+    uint32_t capacity;
+    uint64_t *samples;
+
+    if (ped->sparse) {
+        // Sparse peds are only ever cleared back to zero, so there is
+        // nothing to save
+        ped->journal_mark[node] = ped->journal_epoch;
+        ped->journal_nodes[ped->journal_len++] = node;
+        return;
+    }
+    if (ped->journal_len == ped->journal_samples_capacity) {
+        capacity = ped->journal_samples_capacity == 0
+            ? 256 : 2 * ped->journal_samples_capacity;
+        capacity = min_int(capacity, ped->num_nodes);
+        samples = realloc(ped->journal_samples,
+                (size_t) capacity * num_words * sizeof(uint64_t));
+        if (samples == NULL) {
+            // Without room to save the node, ped_reset falls back on
+            // ped_restart
+            ped->journal_epoch = 0;
+            return;
+        }
+        ped->journal_samples = samples;
+        ped->journal_samples_capacity = capacity;
+    }
+    ped->journal_mark[node] = ped->journal_epoch;
+    ped->journal_nodes[ped->journal_len] = node;
+    ped->journal_weights[ped->journal_len] = ped->weights[node];
+    ped->journal_genotypes[ped->journal_len] = ped->genotypes[node];
+    ped->journal_climb_state[ped->journal_len] = ped->climb_state[node];
+    ped->journal_max_coal[ped->journal_len] = ped->max_coal[node];
+    memcpy(ped->journal_samples + (size_t) ped->journal_len * num_words,
+            node_samples(ped, node), num_words * sizeof(uint64_t));
+    ped->journal_len++;
+}
 
-    ped = calloc(1, sizeof(ped_t));
-    assert(ped != NULL);
-    ret = ped_alloc_rng(ped);
-    assert(ret == 0);
+static inline void ped_journal(ped_t *ped, int node) {
+    // Saves node before its first change since the journal was opened
+    if (ped->journal_epoch != 0
+            && ped->journal_mark[node] != ped->journal_epoch) {
+        ped_journal_add(ped, node);
+    }
+}
 
-    // Maybe all these should be calloc'd and freed as well?
-    ped->num_nodes = 0;
-    ped->num_samples = 0;
-    ped->num_active_lineages = 0;
-    ped->node_array = NULL;
-    ped->samples = NULL;
-    ped->active_lineages = NULL;
+static void ped_reset_lineages(ped_t *ped) {
+    int i, s_idx;
+    lineage_t *l = NULL;
 
-    return ped;
-}
+    for (i = 0; i < ped->num_samples; i++) {
+        s_idx = ped->samples[i];
 
-int node_init(node_t *node, int num_samples) {
-    node->ID = -1;
-    node->weight = 0;
-    node->genotype = 0;
-    node->climbed_to_mother = 0;
-    node->climbed_to_father = 0;
-    node->father = NULL;
-    node->mother = NULL;
-    node->active_samples = calloc(num_samples, sizeof(int));
+        l = &ped->active_lineages[i];
+        l->idx = s_idx;
+        l->node = s_idx;
+        l->status = 'A'; // Initial state is 'active'
 
-    return 0;
+        if (ped->sparse) {
+            ped_journal(ped, s_idx);
+        }
+        ped->genotypes[s_idx] = ped->sample_genotypes[i];
+    }
+    ped->num_active_lineages = ped->num_samples;
+
+    // Nothing has happened yet in this simulation
+    ped->loglik = 0;
+    ped->last_coal_node = -1;
+    ped->last_founder = -1;
 }
 
-int free_ped(ped_t *ped) {
+int ped_load_samples_from_idx(ped_t *ped, int *samples_idx, int *genotypes, int num_samples) {
+    int ret = 0;
     int i;
-    int count = 0;
-    node_t *node;
 
-    if (ped->samples != NULL) {
-        printf("Freeing ped->samples\n");
-        free(ped->samples);
-    }
-    if (ped->active_lineages != NULL) {
-        printf("Freeing ped->active_lineages\n");
-        free(ped->active_lineages);
-    }
-    for (i = 0; i < ped->num_nodes; i++) {
-        node = &ped->node_array[i];
+    assert(num_samples == ped->num_samples);
+    printf("Loading %d samples\n", num_samples);
 
-        if (node->active_samples != NULL) {
-            count++;
-            free(node->active_samples);
+    for (i = 0; i < num_samples; i++) {
+        ped->samples[i] = ped_node_from_idx(ped, samples_idx[i]);
+        if (ped->samples[i] == -1) {
+            printf("Error - sample %d is not in the pedigree\n", samples_idx[i]);
+            ret = 1;
+            goto out;
         }
+        ped->sample_genotypes[i] = genotypes[i];
     }
-    if (count > 0) {
-        printf("Freed %d node->active_samples\n", count);
-    }
-    if (ped->node_array != NULL) {
-        printf("Freeing ped->node_array\n");
-        free(ped->node_array);
-    }
-    gsl_rng_free(ped->rng);
-    free(ped);
-
-    return 0;
+    ped->journal_epoch = 0;
+    ped_reset_lineages(ped);
+    printf("Done loading samples\n");
+out:
+    return ret;
 }
 
-int ped_nodes_alloc(ped_t *ped, uint32_t num_nodes, int num_samples) {
+int ped_load_samples_from_node(ped_t *ped, const int32_t *nodes,
+        const int *genotypes, uint32_t num_samples) {
+    // Quiet counterpart of ped_load_samples_from_idx taking node numbers,
+    // for loading many sample sets in a row
     int ret = 0;
-    int i;
-    node_t *a, *n;
+    uint32_t i;
 
-    ped->num_nodes = num_nodes;
-    ped->node_array = calloc(num_nodes, sizeof(node_t));
-    if (ped->node_array == NULL){
-        ret = 1;
+    ret = ped_samples_alloc(ped, num_samples);
+    if (ret != 0) {
         goto out;
     }
-
-    i = 0;
-    for (a = ped->node_array; i < num_nodes; i++) {
-        n = a + i;
-        node_init(n, num_samples);
+    for (i = 0; i < num_samples; i++) {
+        if (nodes[i] < 0 || nodes[i] >= ped->num_nodes) {
+            printf("Error - sample node %d is not in the pedigree\n", nodes[i]);
+            ret = 1;
+            goto out;
+        }
+        ped->samples[i] = nodes[i];
+        ped->sample_genotypes[i] = genotypes[i];
     }
+    // A sparse ped's journal tracks what it changed since it was cleared,
+    // which new samples don't affect
+    if (!ped->sparse) {
+        ped->journal_epoch = 0;
+    }
+    ped_reset_lineages(ped);
 out:
     return ret;
 }
 
-int ped_samples_alloc(ped_t *ped, uint32_t num_samples) {
-    int ret = 0;
-    int i;
+static void ped_clear_journaled(ped_t *ped) {
+    // ped_clear_state for a sparse ped whose journal lists every node it
+    // has changed
+    uint32_t i, num_words = ped->num_sample_words;
+    int node;
+
+    for (i = 0; i < ped->journal_len; i++) {
+        node = ped->journal_nodes[i];
+        ped->weights[node] = 0;
+        ped->genotypes[node] = 0;
+        ped->climb_state[node] = 0;
+        ped->max_coal[node] = 0;
+        memset(node_samples(ped, node), 0, num_words * sizeof(uint64_t));
+    }
+    ped->weight_bound = 0;
+    ped_drop_coal_queue(ped);
+    ped_journal_open(ped);
+}
 
-    ped->num_samples = num_samples;
-    ped->num_active_lineages = num_samples;
+int ped_clear_state(ped_t *ped) {
+    // Zeroes everything a simulation or ped_init_sample_weights changes.
+    // The update worklist is always left empty, and the parent weight
+    // scratch is keyed on pw_query, so neither needs clearing.
+    int ret = 0;
+    size_t n = ped->num_nodes;
+    ped_scratch_t *scratch = ped->scratch;
 
-    ped->samples = calloc(num_samples, sizeof(node_t*));
-    if (ped->samples == NULL){
-        ret = 1;
+    if (ped->sparse && ped->journal_epoch != 0) {
+        ped_clear_journaled(ped);
         goto out;
     }
-    ped->active_lineages = calloc(num_samples, sizeof(lineage_t));
-    if (ped->active_lineages == NULL){
-        ret = 1;
-        goto out;
+    memset(ped->weights, 0, n * sizeof(double));
+    ped->weight_bound = 0;
+    memset(ped->genotypes, 0, n * sizeof(int8_t));
+    memset(ped->climb_state, 0, n * sizeof(uint8_t));
+    memset(ped->active_samples, 0,
+            n * ped->num_sample_words * sizeof(uint64_t));
+    memset(ped->max_coal, 0, n * sizeof(int32_t));
+    memset(scratch->coal_queued, 0, n * sizeof(char));
+    scratch->coal_queue_head = 0;
+    scratch->coal_queue_len = 0;
+    ped->journal_epoch = 0;
+    // From zero, a sparse ped's journal can start listing changes
+    if (ped->sparse) {
+        ped_journal_open(ped);
     }
-    printf("Allocated active_lineages\n");
 out:
     return ret;
 }
 
-int ped_load(ped_t *ped, int *inds, int *fathers, int *mothers, int num_inds) {
+int ped_restart(ped_t *ped) {
+    // Puts the samples back at the bottom of the pedigree with fresh
+    // weights, ready to simulate another replicate
     int ret = 0;
-    int i;
-    node_t *n;
-    int ID;
-    node_t *father, *mother;
 
-    for (i = 0; i < num_inds; i++) {
-        n = &ped->node_array[i];
-        ID = inds[i];
-        father = NULL;
-        mother = NULL;
-
-        if (fathers[i] != -1) {
-            father = &ped->node_array[fathers[i]];
-        } else {
-        }
-        if (mothers[i] != -1) {
-            mother = &ped->node_array[mothers[i]];
-        }
-        n->ID = ID;
-        n->father = father;
-        n->mother = mother;
+    ped->stats.restarts++;
+    ret = ped_clear_state(ped);
+    if (ret != 0) {
+        goto out;
     }
-
+    ped_reset_lineages(ped);
+    ret = ped_init_sample_weights(ped);
+out:
     return ret;
 }
 
-int ped_load_samples_from_idx(ped_t *ped, int *samples_idx, int *genotypes, int num_samples) {
+int ped_reset(ped_t *ped) {
+    // Same as ped_restart, but only puts back the nodes the last replicate
+    // changed, as saved in the journal, so it takes time in proportion to
+    // how much of the pedigree the replicate reached rather than to its
+    // size. Falls back on ped_restart when there is no journal.
     int ret = 0;
-    int i, s_idx;
-    node_t *n = NULL;
-    lineage_t *l = NULL;
-
-    assert(num_samples == ped->num_samples);
-    printf("Loading %d samples\n", num_samples);
-
-    for (i = 0; i < num_samples; i++) {
-        s_idx = samples_idx[i];
-        n = &ped->node_array[s_idx];
-        ped->samples[i] = n;
-        printf("%d\n", i);
+    uint32_t i, num_words = ped->num_sample_words;
+    int node;
 
-        l = &ped->active_lineages[i];
-        l->idx = s_idx;
-        l->node = n;
-        l->status = 'A'; // Initial state is 'active'
+    if (ped->journal_epoch == 0) {
+        ret = ped_restart(ped);
+        goto out;
+    }
 
-        n->genotype = genotypes[i];
+    ped->stats.resets++;
+    ped->stats.reset_nodes += ped->journal_len;
+    if (ped->sparse) {
+        // Nothing was saved, but clearing the journaled nodes and
+        // initialising again only visits the samples' ancestors
+        ped_clear_journaled(ped);
+        ped_reset_lineages(ped);
+        ret = ped_init_sample_weights(ped);
+        goto out;
     }
-    printf("Done loading samples\n");
+    for (i = 0; i < ped->journal_len; i++) {
+        node = ped->journal_nodes[i];
+        ped->weights[node] = ped->journal_weights[i];
+        ped->genotypes[node] = ped->journal_genotypes[i];
+        ped->climb_state[node] = ped->journal_climb_state[i];
+        ped->max_coal[node] = ped->journal_max_coal[i];
+        memcpy(node_samples(ped, node),
+                ped->journal_samples + (size_t) i * num_words,
+                num_words * sizeof(uint64_t));
+    }
+    // Repairs still queued were to values that have just been put back
+    ped_drop_coal_queue(ped);
+    ped_reset_lineages(ped);
+    // Lineages are numbered by sample, as ped_init_sample_weights left them
+    for (i = 0; i < ped->num_samples; i++) {
+        ped->active_lineages[i].idx = i;
+    }
+    ped_journal_open(ped);
+out:
     return ret;
 }
 
 int ped_print_samples(ped_t *ped) {
     int ret = 0;
-    int i;
-    node_t n;
+    int i, n;
 
     for (i = 0; i < ped->num_samples; i++)  {
-        n = *ped->samples[i];
-        printf("Sample ID: %d, weight: %f\n", n.ID, n.weight);
+        n = ped->samples[i];
+        printf("Sample ID: %d, weight: %f\n", ped->ids[n], ped->weights[n]);
     }
     return ret;
 }
 
 int ped_print_lineages(ped_t *ped) {
     int ret = 0;
-    int i, j;
+    int i;
     lineage_t *l;
-    node_t *n;
 
     printf("Active\n");
     for (i = 0; i < ped->num_samples; i++)  {
@@ -230,10 +1376,9 @@ int ped_print_lineages(ped_t *ped) {
             printf("Inactive\n");
         }
         l = &ped->active_lineages[i];
-        n = l->node;
 
         printf("Lineage idx: %d, node ID: %d, status: %c\n",
-                l->idx, n->ID, l->status);
+                l->idx, ped->ids[l->node], l->status);
     }
     return ret;
 }
@@ -241,30 +1386,24 @@ int ped_print_lineages(ped_t *ped) {
 int ped_print_nodes(ped_t *ped) {
     int ret = 0;
     int i, j;
-    node_t *n;
 
     for (i = 0; i < ped->num_nodes; i++)  {
-        n = &ped->node_array[i];
         printf("Node ID: %d, weight: %f, genotype: %d",
-                n->ID, n->weight, n->genotype);
+                ped->ids[i], ped->weights[i], ped->genotypes[i]);
 
-        if (n->active_samples != NULL) {
-            printf(", active_samples: [ ");
-            for (j = 0; j < ped->num_samples; j++) {
-                printf("%d ", n->active_samples[j]);
-            }
-            printf("]");
-        } else {
-            printf(", active_samples: not allocated");
+        printf(", active_samples: [ ");
+        for (j = 0; j < ped->num_samples; j++) {
+            printf("%d ", bitset_test(node_samples(ped, i), j));
         }
+        printf("]");
 
-        printf(", max_coal %d", node_get_max_coalescences(ped, n));
+        printf(", max_coal %d", node_get_max_coalescences(ped, i));
 
-        if (n->father != NULL) {
-            printf(", father: %d", n->father->ID);
+        if (ped->fathers[i] != -1) {
+            printf(", father: %d", ped->ids[ped->fathers[i]]);
         }
-        if (n->mother != NULL) {
-            printf(", mother: %d\n", n->mother->ID);
+        if (ped->mothers[i] != -1) {
+            printf(", mother: %d\n", ped->ids[ped->mothers[i]]);
         } else {
             printf(", founder\n");
         }
@@ -273,45 +1412,78 @@ int ped_print_nodes(ped_t *ped) {
     return ret;
 }
 
-node_t* ped_get_node(ped_t *ped, int node_idx) {
-    node_t *node;
+uint64_t *node_samples(ped_t *ped, int node) {
+    return ped->active_samples + (size_t) node * ped->num_sample_words;
+}
 
-    node = &ped->node_array[node_idx];
+static void ped_queue_ancestor_update(ped_t *ped, int node, double delta) {
+    ped_scratch_t *scratch = ped->scratch;
 
-    return node;
+    if (scratch->update_queued[node] == 0) {
+        scratch->update_queued[node] = 1;
+        scratch->update_delta[node] = delta;
+        scratch->update_next[node] = scratch->update_head[ped->gens[node]];
+        scratch->update_head[ped->gens[node]] = node;
+    } else {
+        scratch->update_delta[node] += delta;
+    }
 }
 
-int ped_update_ancestor_weights(ped_t *ped, node_t *node, int sample_idx, double delta) {
+int ped_update_ancestor_weights(ped_t *ped, int node, int sample_idx, double delta) {
     // TODO: This will eventually need to be updated - currently only tracks a
     // single index per lineage, but in fact we need to track the index of this
     // lineage as well as all those which have coalesced with it
     // --> alternatively, update active_samples of all nodes to 0 when a
     // lineage coalesces, and decrement minimum number of possible coalescences
 
+    // Every path from node to an ancestor halves delta once per generation.
+    // Ancestors are visited from the youngest generation to the oldest, so
+    // by the time one is visited all of its offspring in the cone have
+    // added their share, and it is updated once with the summed delta.
     int ret = 0;
-    node_t *mother, *father;
-
-    /* printf("Updating ancestor %d, with index %d\n", */
-    /*         node->ID, sample_idx); */
+    int g, n;
+    double d;
+    uint64_t *samples;
+    ped_scratch_t *scratch = ped->scratch;
+    uint64_t start = stats_clock(&ped->stats);
 
     assert(delta != 0);
     assert(sample_idx >= 0);
-    assert(node->active_samples != NULL);
-    node->weight = node->weight + delta;
-
-    if (delta < 0) {
-        assert(node->active_samples[sample_idx] == 1);
-        node->active_samples[sample_idx] = 0;
-    } else if (delta > 0) {
-        node->active_samples[sample_idx] = 1;
-    }
+    ped->stats.update_calls++;
+
+    ped_queue_ancestor_update(ped, node, delta);
+    for (g = ped->gens[node]; g >= 0; g--) {
+        while (scratch->update_head[g] != -1) {
+            n = scratch->update_head[g];
+            scratch->update_head[g] = scratch->update_next[n];
+            scratch->update_queued[n] = 0;
+            d = scratch->update_delta[n];
+
+            ped->stats.update_nodes++;
+            ped_journal(ped, n);
+            ped->weights[n] += d;
+            if (fabs(ped->weights[n]) > ped->weight_bound) {
+                ped->weight_bound = fabs(ped->weights[n]);
+            }
+            samples = node_samples(ped, n);
+            if (d < 0) {
+                assert(bitset_test(samples, sample_idx) == 1);
+                bitset_clear(samples, sample_idx);
+                ped_mark_coalescences_dirty(ped, n);
+            } else if (d > 0 && bitset_test(samples, sample_idx) == 0) {
+                bitset_set(samples, sample_idx);
+                ped_mark_coalescences_dirty(ped, n);
+            }
 
-    if (node->father != NULL) {
-        ret = ped_update_ancestor_weights(ped, node->father, sample_idx, delta / 2);
-    }
-    if (node->mother != NULL) {
-        ret = ped_update_ancestor_weights(ped, node->mother, sample_idx, delta / 2);
+            if (ped->fathers[n] != -1) {
+                ped_queue_ancestor_update(ped, ped->fathers[n], d / 2);
+            }
+            if (ped->mothers[n] != -1) {
+                ped_queue_ancestor_update(ped, ped->mothers[n], d / 2);
+            }
+        }
     }
+    STATS_TIME(&ped->stats, update_ns, start);
 
     return ret;
 }
@@ -321,63 +1493,370 @@ int ped_set_all_weights(ped_t *ped, double val) {
     int i;
 
     for (i = 0; i < ped->num_nodes; i++) {
-        ped->node_array[i].weight = val;
+        ped->weights[i] = val;
     }
+    ped->weight_bound = fabs(val);
+    ped->journal_epoch = 0;
 
     return ret;
 }
 
+static void ped_init_gather(ped_t *ped, int32_t n) {
+    // Adds half the weight and all the samples of each of n's offspring to
+    // n, which already holds its own lineages. Offspring are read in a
+    // fixed order, so the sum comes out the same on any number of threads.
+    uint32_t i, j;
+    uint32_t num_words = ped->num_sample_words;
+    int32_t child;
+    uint64_t *samples, *child_samples;
+    double weight = ped->weights[n];
+
+    samples = node_samples(ped, n);
+    for (i = ped->offspring_start[n]; i < ped->offspring_start[n + 1]; i++) {
+        child = ped->offspring[i];
+        // Nodes outside the samples' ancestry have nothing to hand on
+        if (ped->weights[child] == 0) {
+            continue;
+        }
+        weight += ped->weights[child] / 2;
+        child_samples = node_samples(ped, child);
+        for (j = 0; j < num_words; j++) {
+            samples[j] |= child_samples[j];
+        }
+    }
+    ped->weights[n] = weight;
+}
+
+static void ped_init_max_coal(ped_t *ped, int32_t n) {
+    int32_t max_coal;
+
+    max_coal = bitset_count(node_samples(ped, n), ped->num_sample_words);
+    if (ped->fathers[n] != -1) {
+        max_coal = max_int(max_coal, ped->max_coal[ped->fathers[n]]);
+    }
+    if (ped->mothers[n] != -1) {
+        max_coal = max_int(max_coal, ped->max_coal[ped->mothers[n]]);
+    }
+    ped->max_coal[n] = max_coal;
+}
+
+static void ped_init_sparse_weights(ped_t *ped) {
+    // ped_init_sample_weights for sparse peds, which only visits the
+    // ancestors of the samples. They are taken off the update worklist a
+    // generation at a time from the deepest up, gathering from their
+    // offspring as in the full sweep so the weights come out the same, then
+    // set max_coal in the opposite order.
+    uint32_t i, len;
+    uint32_t num_words = ped->num_sample_words;
+    int g, k, n;
+    int32_t parents[2];
+    double weight_bound = 0;
+    lineage_t *lineage;
+    ped_scratch_t *scratch = ped->scratch;
+
+    if (ped->journal_epoch != 0) {
+        for (i = 0; i < ped->journal_len; i++) {
+            n = ped->journal_nodes[i];
+            ped->weights[n] = 0;
+            ped->max_coal[n] = 0;
+            memset(node_samples(ped, n), 0, num_words * sizeof(uint64_t));
+        }
+    } else {
+        memset(ped->weights, 0, ped->num_nodes * sizeof(double));
+        memset(ped->max_coal, 0, ped->num_nodes * sizeof(int32_t));
+        memset(ped->active_samples, 0,
+                (size_t) ped->num_nodes * num_words * sizeof(uint64_t));
+    }
+    for (i = 0; i < ped->num_active_lineages; i++) {
+        lineage = &ped->active_lineages[i];
+        lineage->idx = i;
+        ped_journal(ped, lineage->node);
+        ped->weights[lineage->node] += 1;
+        bitset_set(node_samples(ped, lineage->node), i);
+        ped_queue_ancestor_update(ped, lineage->node, 0);
+    }
+
+    // The order nodes are visited in is kept in pw_cone, which is free
+    // outside node_get_parent_weight
+    len = 0;
+    for (g = ped->max_gen; g >= 0; g--) {
+        while (scratch->update_head[g] != -1) {
+            n = scratch->update_head[g];
+            scratch->update_head[g] = scratch->update_next[n];
+            scratch->update_queued[n] = 0;
+
+            ped_init_gather(ped, n);
+            scratch->pw_cone[len++] = n;
+            parents[0] = ped->fathers[n];
+            parents[1] = ped->mothers[n];
+            for (k = 0; k < 2; k++) {
+                if (parents[k] != -1) {
+                    ped_journal(ped, parents[k]);
+                    ped_queue_ancestor_update(ped, parents[k], 0);
+                }
+            }
+        }
+    }
+    for (i = len; i-- > 0;) {
+        n = scratch->pw_cone[i];
+        ped_init_max_coal(ped, n);
+        weight_bound = fmax(weight_bound, ped->weights[n]);
+    }
+    ped->weight_bound = weight_bound;
+    ped_drop_coal_queue(ped);
+}
+
 int ped_init_sample_weights(ped_t *ped) {
+    // Sets the weight and sample set of every node from the active
+    // lineages in one sweep from the deepest generation up, rather than an
+    // ancestor walk per lineage. Each node gathers half the weight and all
+    // the samples of its offspring, which are in deeper generations and so
+    // are already complete. Sample sets are OR'd a word of 64 samples at a
+    // time in a loop the compiler vectorizes. A second sweep back down then
+    // sets max_coal for every node, so nothing is left for
+    // ped_repair_max_coalescences.
+    //
+    // Nodes of the same generation don't depend on each other, so each
+    // generation is split between threads, with a barrier before the next.
+    // Every node is written by the one thread that owns it, and the result
+    // doesn't depend on how many threads there are.
     int ret = 0;
-    int i;
+    uint32_t i, g;
+    uint32_t num_words = ped->num_sample_words;
+    int threads = 1;
+    double weight_bound = 0;
     lineage_t *lineage;
+    uint64_t start = stats_clock(&ped->stats);
 
-    for (i = 0; i < ped->num_active_lineages; i++) {
-        lineage = &ped->active_lineages[i];
-        lineage->idx= i;
-        ret = ped_update_ancestor_weights(ped, lineage->node, lineage->idx, 1);
-        if (ret != 0) {
-            goto out;
+    ped->stats.init_calls++;
+    if (ped->sparse) {
+        ped_init_sparse_weights(ped);
+        goto out;
+    }
+#ifdef _OPENMP
+    if (ped->num_nodes >= PED_PARALLEL_INIT_NODES) {
+        threads = ped->num_threads > 0 ? ped->num_threads
+            : omp_get_max_threads();
+    }
+#endif
+
+    #pragma omp parallel num_threads(threads) private(i, g, lineage) \
+        reduction(max: weight_bound)
+    {
+        #pragma omp for
+        for (i = 0; i < ped->num_nodes; i++) {
+            ped->weights[i] = 0;
+            memset(node_samples(ped, i), 0, num_words * sizeof(uint64_t));
+        }
+        #pragma omp single
+        for (i = 0; i < ped->num_active_lineages; i++) {
+            lineage = &ped->active_lineages[i];
+            lineage->idx = i;
+            ped->weights[lineage->node] += 1;
+            bitset_set(node_samples(ped, lineage->node), i);
+        }
+
+        for (g = 0; g <= ped->max_gen; g++) {
+            #pragma omp for
+            for (i = ped->gen_start[g]; i < ped->gen_start[g + 1]; i++) {
+                ped_init_gather(ped, ped->gen_order[i]);
+            }
+        }
+        for (g = ped->max_gen + 1; g-- > 0;) {
+            #pragma omp for
+            for (i = ped->gen_start[g]; i < ped->gen_start[g + 1]; i++) {
+                ped_init_max_coal(ped, ped->gen_order[i]);
+                weight_bound = fmax(weight_bound,
+                        ped->weights[ped->gen_order[i]]);
+            }
         }
     }
+    ped->weight_bound = weight_bound;
+
+    ped_drop_coal_queue(ped);
+    ped_journal_open(ped);
 out:
+    STATS_TIME(&ped->stats, init_ns, start);
+
     return ret;
 }
 
-double node_get_parent_weight(node_t *node, int gen) {
+static int ped_parent_weight_cone(ped_t *ped, int node, uint32_t depth) {
+    // Breadth-first walk over the ancestors of node, recording each one
+    // once with its shortest distance. Ancestors at depth or beyond are
+    // not needed.
+    int head, len, dist, k, n;
+    int32_t parents[2];
+    ped_scratch_t *scratch = ped->scratch;
+
+    scratch->pw_query++;
+    len = 0;
+    scratch->pw_cone[len] = node;
+    scratch->pw_dist[len] = 0;
+    scratch->pw_mark[node] = scratch->pw_query;
+    scratch->pw_slot[node] = len;
+    len++;
+
+    for (head = 0; head < len; head++) {
+        n = scratch->pw_cone[head];
+        dist = scratch->pw_dist[head] + 1;
+        if (dist >= depth) {
+            break;
+        }
+        parents[0] = ped->fathers[n];
+        parents[1] = ped->mothers[n];
+        for (k = 0; k < 2; k++) {
+            if (parents[k] == -1) {
+                continue;
+            }
+            if (scratch->pw_mark[parents[k]] != scratch->pw_query) {
+                scratch->pw_cone[len] = parents[k];
+                scratch->pw_dist[len] = dist;
+                scratch->pw_mark[parents[k]] = scratch->pw_query;
+                scratch->pw_slot[parents[k]] = len;
+                len++;
+            }
+        }
+    }
+
+    return len;
+}
+
+static double ped_parent_weight_row(ped_t *ped, int parent, int k) {
+    // Entry k of a parent's table row, or 0 if it is outside the cone
+    ped_scratch_t *scratch = ped->scratch;
+
+    if (parent == -1 || scratch->pw_mark[parent] != scratch->pw_query) {
+        return 0;
+    }
+    return scratch->pw_table[scratch->pw_slot[parent] * PED_PARENT_WEIGHT_DEPTH + k];
+}
+
+int ped_set_parent_weight_depth(ped_t *ped, uint32_t depth, double tolerance) {
+    // Opts in to faster, approximate parent weights which leave out
+    // ancestors depth or more generations up, or with a tolerance above 0,
+    // as few generations as keep each error bound within tolerance.
     int ret = 0;
-    double weight;
-    node_t *mother, *father;
 
-    assert(node != NULL);
+    if (depth < 2 || depth > PED_PARENT_WEIGHT_DEPTH) {
+        printf("Error - parent weight depth must be from 2 to %d\n",
+                PED_PARENT_WEIGHT_DEPTH);
+        ret = 1;
+        goto out;
+    }
+    ped->pw_depth = depth;
+    ped->pw_tolerance = tolerance;
+out:
+    return ret;
+}
+
+double ped_parent_weight_error(ped_t *ped, uint32_t depth, int gen) {
+    // Bound on how far node_get_parent_weight(ped, node, gen) for any node
+    // is from the full sum when it stops at depth >= 2 generations. Each of
+    // the at most 2^L paths of length L >= depth to an ancestor a adds
+    // (weight[a] - 0.5) * 2^-(L gen + L(L - 1) / 2), so the bound on the
+    // paths of each length is at most half that of the length before, and
+    // the tail is at most twice its first term. Rounding is not included.
+    int d = depth;
+    int exponent = d * (gen - 1) + d * (d - 1) / 2;
+
+    return ldexp(2 * (ped->weight_bound + 0.5), -exponent);
+}
 
-    // Since this is a parent, the weight includes signal from the offspring
-    // being climbed, which we must subtract. Subsequent generations have this
-    // subtraction adjusted automatically by the generation coefficient.
-    weight = node->weight - 0.5;
+static uint32_t ped_parent_weight_depth(ped_t *ped, int gen) {
+    uint32_t depth = ped->pw_depth;
 
-    if (node->father != NULL) {
-        weight += pow(2, -gen) * node_get_parent_weight(node->father, gen + 1);
+    if (ped->pw_tolerance > 0) {
+        for (depth = 2; depth < ped->pw_depth; depth++) {
+            if (ped_parent_weight_error(ped, depth, gen) <= ped->pw_tolerance) {
+                break;
+            }
+        }
     }
+    return depth;
+}
 
-    if (node->mother != NULL) {
-        weight += pow(2, -gen) * node_get_parent_weight(node->mother, gen + 1);
+double node_get_parent_weight(ped_t *ped, int node, int gen) {
+    // Equivalent to the recursion
+    //
+    //   W(n, g) = weight[n] - 0.5 + 2^-g * (W(father, g + 1) + W(mother, g + 1))
+    //
+    // but each ancestor in the cone is evaluated once per generation offset
+    // k = g - gen rather than once per path. Rows are filled from the
+    // deepest offset down, so parents' entries at k + 1 are ready when a
+    // node's entry at k is computed.
+    int s, k, len, n;
+    uint32_t depth;
+    double *table;
+    double scale;
+    uint64_t start;
+    ped_scratch_t *scratch = ped->scratch;
+
+    assert(node >= 0 && node < ped->num_nodes);
+    assert(gen >= 0);
+    ped->stats.parent_weight_calls++;
+    depth = ped_parent_weight_depth(ped, gen);
+    ped->pw_error = ped_parent_weight_error(ped, depth, gen);
+
+    start = stats_clock(&ped->stats);
+    len = ped_parent_weight_cone(ped, node, depth);
+    ped->stats.parent_weight_nodes += len;
+    // The cone is breadth-first, so its last node is the deepest
+    ped->stats.parent_weight_depth += scratch->pw_dist[len - 1];
+    if (scratch->pw_dist[len - 1] > ped->stats.parent_weight_max_depth) {
+        ped->stats.parent_weight_max_depth = scratch->pw_dist[len - 1];
+    }
+    if (len > scratch->pw_table_rows) {
+        table = realloc(scratch->pw_table,
+                len * PED_PARENT_WEIGHT_DEPTH * sizeof(double));
+        assert(table != NULL);
+        scratch->pw_table = table;
+        scratch->pw_table_rows = len;
     }
 
-    return weight;
+    for (k = depth - 1; k >= 0; k--) {
+        if (gen + k < PED_PARENT_WEIGHT_DEPTH) {
+            scale = ped->pw_scale[gen + k];
+        } else {
+            scale = ldexp(1.0, -(gen + k));
+        }
+        // Cone is in breadth-first order, so nodes reachable within k
+        // generations form a prefix
+        for (s = 0; s < len && scratch->pw_dist[s] <= k; s++) {
+            n = scratch->pw_cone[s];
+            // Since this is a parent, the weight includes signal from the
+            // offspring being climbed, which we must subtract. Subsequent
+            // generations have this subtraction adjusted automatically by
+            // the generation coefficient.
+            scratch->pw_table[s * PED_PARENT_WEIGHT_DEPTH + k] = ped->weights[n] - 0.5;
+            if (k + 1 < depth) {
+                scratch->pw_table[s * PED_PARENT_WEIGHT_DEPTH + k] += scale * (
+                        ped_parent_weight_row(ped, ped->fathers[n], k + 1) +
+                        ped_parent_weight_row(ped, ped->mothers[n], k + 1));
+            }
+        }
+    }
+
+    STATS_TIME(&ped->stats, parent_weight_ns, start);
+
+    return scratch->pw_table[0];
 }
 
 double ped_get_node_weight_from_idx(ped_t *ped, int node_idx) {
-    double weight = 0;
-    node_t *node;
-
-    node = ped_get_node(ped, node_idx);
-    weight = node_get_parent_weight(node, 0);
+    // NAN for nodes pruned away by ped_load_pruned, which aren't ancestors
+    // of any sample
+    double weight = NAN;
+    int node;
+
+    node = ped_node_from_idx(ped, node_idx);
+    if (node != -1) {
+        weight = node_get_parent_weight(ped, node, 0);
+    }
 
     return weight;
 }
 
-int update_parent_carrier(ped_t *ped, node_t *node, int sample_idx) {
+int update_parent_carrier(ped_t *ped, int node, int sample_idx) {
     int ret = 0;
 
     ret = ped_update_ancestor_weights(ped, node, sample_idx, 0.5);
@@ -390,10 +1869,9 @@ out:
 
 int update_parent_carrier_from_idx(ped_t *ped, int node_idx, int sample_idx) {
     int ret = 0;
-    node_t *node;
 
-    node = ped_get_node(ped, node_idx);
-    ret = ped_update_ancestor_weights(ped, node, sample_idx, 0.5);
+    ret = ped_update_ancestor_weights(ped, ped_node_from_idx(ped, node_idx),
+            sample_idx, 0.5);
     if (ret != 0) {
         goto out;
     }
@@ -403,10 +1881,9 @@ out:
 
 int update_parent_not_carrier_from_idx(ped_t *ped, int node_idx, int sample_idx) {
     int ret = 0;
-    node_t *node;
 
-    node = ped_get_node(ped, node_idx);
-    ret = ped_update_ancestor_weights(ped, node, sample_idx, -0.5);
+    ret = ped_update_ancestor_weights(ped, ped_node_from_idx(ped, node_idx),
+            sample_idx, -0.5);
     if (ret != 0) {
         goto out;
     }
@@ -414,7 +1891,7 @@ out:
     return ret;
 }
 
-int update_parent_not_carrier(ped_t *ped, node_t *node, int sample_idx) {
+int update_parent_not_carrier(ped_t *ped, int node, int sample_idx) {
     int ret = 0;
 
     ret = ped_update_ancestor_weights(ped, node, sample_idx, -0.5);
@@ -425,80 +1902,123 @@ out:
     return ret;
 }
 
-int node_get_max_coalescences(ped_t *ped, node_t *node) {
-    int i;
-    int max_coal;
+int ped_mark_coalescences_dirty(ped_t *ped, int node) {
+    uint32_t tail;
+    ped_scratch_t *scratch = ped->scratch;
 
-    assert(node != NULL);
-    max_coal = 0;
-    /* printf("Summing %d possible coalescences\n", ped->num_samples); */
-    for (i = 0; i < ped->num_samples; i++) {
-        /* printf("%d\n", i); */
-        max_coal = max_coal + node->active_samples[i];
+    if (scratch->coal_queued[node] == 0) {
+        assert(scratch->coal_queue_len < ped->num_nodes);
+        tail = (scratch->coal_queue_head + scratch->coal_queue_len) % ped->num_nodes;
+        scratch->coal_queue[tail] = node;
+        scratch->coal_queue_len++;
+        scratch->coal_queued[node] = 1;
     }
 
-    if (node->father != NULL) {
-        max_coal = GSL_MAX_INT(
-                max_coal, node_get_max_coalescences(ped, node->father));
-    }
+    return 0;
+}
 
-    if (node->mother != NULL) {
-        max_coal = GSL_MAX_INT(
-                max_coal, node_get_max_coalescences(ped, node->mother));
+int ped_repair_max_coalescences(ped_t *ped) {
+    // A node's max_coal depends only on its own count and its parents'
+    // max_coal, so a change is pushed down to offspring until values stop
+    // changing. Each node is queued at most once at a time.
+    int ret = 0;
+    uint32_t i;
+    int node, child, max_coal;
+    ped_scratch_t *scratch = ped->scratch;
+
+    while (scratch->coal_queue_len > 0) {
+        node = scratch->coal_queue[scratch->coal_queue_head];
+        scratch->coal_queue_head = (scratch->coal_queue_head + 1) % ped->num_nodes;
+        scratch->coal_queue_len--;
+        scratch->coal_queued[node] = 0;
+        ped->stats.max_coal_repairs++;
+
+        max_coal = bitset_count(node_samples(ped, node), ped->num_sample_words);
+        if (ped->fathers[node] != -1) {
+            max_coal = max_int(max_coal, ped->max_coal[ped->fathers[node]]);
+        }
+        if (ped->mothers[node] != -1) {
+            max_coal = max_int(max_coal, ped->max_coal[ped->mothers[node]]);
+        }
+        if (max_coal == ped->max_coal[node]) {
+            continue;
+        }
+        ped_journal(ped, node);
+        ped->max_coal[node] = max_coal;
+
+        for (i = ped->offspring_start[node]; i < ped->offspring_start[node + 1]; i++) {
+            child = ped->offspring[i];
+            // Offspring a sparse ped hasn't journaled are outside the
+            // ancestry of its samples, where max_coal is never read
+            if (ped->sparse && ped->journal_epoch != 0
+                    && ped->journal_mark[child] != ped->journal_epoch) {
+                continue;
+            }
+            ped_mark_coalescences_dirty(ped, child);
+        }
     }
 
-    return max_coal;
+    return ret;
+}
+
+int node_get_max_coalescences(ped_t *ped, int node) {
+    assert(node >= 0 && node < ped->num_nodes);
+    ped->stats.max_coal_calls++;
+    ped_repair_max_coalescences(ped);
+
+    return ped->max_coal[node];
 }
 
 int ped_lineage_update_genotype(ped_t *ped, lineage_t *lineage) {
     // TODO: Pass IS factor as arg to update?
     int ret = 0;
-    node_t *node;
+    int node, mother, father;
     int mother_num_coal, father_num_coal;
-    double loglik = 1; // use ped->loglik?
 
     node = lineage->node;
-    if (node->mother == NULL && node->father == NULL) {
+    mother = ped->mothers[node];
+    father = ped->fathers[node];
+    if (mother == -1 && father == -1) {
         ret = ped_lineage_update_genotype_founder(ped, lineage);
         goto out;
     }
+    ped_journal(ped, node);
 
-    if (node->genotype == 0) {
-        node->genotype = 1;
-    } else if (node->genotype == 1) {
+    if (ped->genotypes[node] == 0) {
+        ped->genotypes[node] = 1;
+    } else if (ped->genotypes[node] == 1) {
         // Need to check if we can create a homozygote
-        printf("Checking if we can make a homozygote in %d\n",
-                node->ID);
         mother_num_coal = father_num_coal = 0;
-        if (node->mother != NULL) {
-            mother_num_coal = node_get_max_coalescences(ped, node->mother);
+        if (mother != -1) {
+            mother_num_coal = node_get_max_coalescences(ped, mother);
         }
-        if (node->father != NULL) {
-            father_num_coal = node_get_max_coalescences(ped, node->father);
+        if (father != -1) {
+            father_num_coal = node_get_max_coalescences(ped, father);
         }
 
         if (mother_num_coal < ped->num_samples ||
                 father_num_coal < ped->num_samples) {
             // Can't create a homozygote - coalesce and we're done
-            loglik = loglik * 0.5;
+            ped->loglik += log(0.5);
             ped_lineage_coalesce(ped, lineage);
         } else {
-            if (gsl_rng_uniform(ped->rng) < ped->sim_homs) {
+            if (rng_uniform(&ped->rng) < ped->sim_homs) {
                 // Homozygote sampled
-                loglik = loglik * (0.5 / ped->sim_homs);
-                node->genotype = 2;
+                ped->loglik += log(0.5 / ped->sim_homs);
+                ped->genotypes[node] = 2;
+                TRACE_EVENT(&ped->trace, TRACE_HOMOZYGOTE, lineage->idx, node,
+                        -1, 0, 0);
                 // Now climb this lineage again to update possible coalescence
                 // points for other lineages
-                if (node->climbed_to_mother == 1) {
+                if (ped->climb_state[node] & CLIMBED_TO_MOTHER) {
                     ped_lineage_set_next_parent(ped, lineage, 'f');
-                } else if (node->climbed_to_father == 1) {
+                } else if (ped->climb_state[node] & CLIMBED_TO_FATHER) {
                     ped_lineage_set_next_parent(ped, lineage, 'm');
                 } else {
-                    printf("Potential homozygote - other allele hasn't climbed yet\n");
                     // The other lineage hasn't climbed yet. Since one
                     // lineage has to go each way, we can choose a parent
                     // uniformly regardless of weights
-                    if (gsl_rng_uniform(ped->rng) < 0.5) {
+                    if (rng_uniform(&ped->rng) < 0.5) {
                         ped_lineage_set_next_parent(ped, lineage, 'm');
                     } else {
                         ped_lineage_set_next_parent(ped, lineage, 'm');
@@ -506,11 +2026,11 @@ int ped_lineage_update_genotype(ped_t *ped, lineage_t *lineage) {
                 }
             } else {
                 // No homozygote sampled - coalesce
-                loglik = loglik * (0.5 / (1 - ped->sim_homs));
+                ped->loglik += log(0.5 / (1 - ped->sim_homs));
                 ped_lineage_coalesce(ped, lineage);
             }
         }
-    } else if (node->genotype == 2) {
+    } else if (ped->genotypes[node] == 2) {
         ped_lineage_coalesce(ped, lineage);
     }
 out:
@@ -519,25 +2039,27 @@ out:
 
 int ped_lineage_update_genotype_founder(ped_t *ped, lineage_t *lineage) {
     int ret = 0;
-    node_t *node;
-    double loglik = 1;
+    int node;
 
     node = lineage->node;
-    assert(node->mother == NULL && node->father == NULL);
+    assert(ped->mothers[node] == -1 && ped->fathers[node] == -1);
+    ped_journal(ped, node);
 
-    if (node->genotype == 0) {
-        node->genotype = 1;
-    } else if (node->genotype == 1) {
-        if (gsl_rng_uniform(ped->rng) < ped->sim_homs) {
+    if (ped->genotypes[node] == 0) {
+        ped->genotypes[node] = 1;
+    } else if (ped->genotypes[node] == 1) {
+        if (rng_uniform(&ped->rng) < ped->sim_homs) {
             // Homozygote sampled
-            loglik = loglik * (0.5 / ped->sim_homs);
-            node->genotype = 2;
+            ped->loglik += log(0.5 / ped->sim_homs);
+            ped->genotypes[node] = 2;
+            TRACE_EVENT(&ped->trace, TRACE_HOMOZYGOTE, lineage->idx, node,
+                    -1, 0, 0);
         } else {
             // No homozygote sampled - coalesce
-            loglik = loglik * (0.5 / (1 - ped->sim_homs));
+            ped->loglik += log(0.5 / (1 - ped->sim_homs));
             ped_lineage_coalesce(ped, lineage);
         }
-    } else if (node->genotype == 2) {
+    } else if (ped->genotypes[node] == 2) {
         ped_lineage_coalesce(ped, lineage);
     }
 
@@ -559,11 +2081,11 @@ int ped_lineage_reached_founder(ped_t *ped, lineage_t *lineage) {
     *lineage = tmp;
 
     // Reduce number of active lineages by 1 and update status
-    assert(lineage->node->mother == NULL && lineage->node->father == NULL);
-    printf("---Lineage %d reached founder %d\n",
-            lineage->idx, lineage->node->ID);
+    assert(ped->mothers[last->node] == -1 && ped->fathers[last->node] == -1);
+    TRACE_EVENT(&ped->trace, TRACE_FOUNDER, last->idx, last->node, -1, 0, 0);
     ped->num_active_lineages--;
-    lineage->status = 'F';
+    last->status = 'F';
+    ped->last_founder = last->node;
 
     return ret;
 }
@@ -580,32 +2102,33 @@ int ped_lineage_coalesce(ped_t *ped, lineage_t *lineage) {
     *lineage = tmp;
 
     // Reduce number of active lineages by 1 and update status
-    printf("Coalescing lineage %d in node %d\n",
-            last->idx, last->node->ID);
+    TRACE_EVENT(&ped->trace, TRACE_COALESCE, last->idx, last->node, -1, 0, 0);
     ped->num_active_lineages--;
     last->status = 'C';
+    ped->last_coal_node = last->node;
 
     return ret;
 }
 
 int ped_lineage_set_next_parent(ped_t *ped, lineage_t *lineage, char parent) {
     int ret = 0;
-    node_t *node;
+    int node;
 
     node = lineage->node;
+    ped_journal(ped, node);
 
     if (parent == 'f') {
-        assert(node->climbed_to_father == 0);
-        update_parent_not_carrier(ped, node->mother, lineage->idx);
-        update_parent_carrier(ped, node->father, lineage->idx);
-        node->climbed_to_father = 1;
-        lineage->node = node->father;
+        assert((ped->climb_state[node] & CLIMBED_TO_FATHER) == 0);
+        update_parent_not_carrier(ped, ped->mothers[node], lineage->idx);
+        update_parent_carrier(ped, ped->fathers[node], lineage->idx);
+        ped->climb_state[node] |= CLIMBED_TO_FATHER;
+        lineage->node = ped->fathers[node];
     } else if (parent == 'm') {
-        assert(node->climbed_to_mother == 0);
-        update_parent_not_carrier(ped, node->father, lineage->idx);
-        update_parent_carrier(ped, node->mother, lineage->idx);
-        node->climbed_to_mother = 1;
-        lineage->node = node->mother;
+        assert((ped->climb_state[node] & CLIMBED_TO_MOTHER) == 0);
+        update_parent_not_carrier(ped, ped->fathers[node], lineage->idx);
+        update_parent_carrier(ped, ped->mothers[node], lineage->idx);
+        ped->climb_state[node] |= CLIMBED_TO_MOTHER;
+        lineage->node = ped->mothers[node];
     } else {
         printf("Error - incorrectly specified parent type: %c\n",
                 parent);
@@ -616,70 +2139,74 @@ int ped_lineage_set_next_parent(ped_t *ped, lineage_t *lineage, char parent) {
     return ret;
 }
 
+static int ped_lineage_choose(ped_t *ped, lineage_t *lineage, char parent,
+        double mother_weight, double father_weight) {
+    TRACE_EVENT(&ped->trace, TRACE_CHOICE, lineage->idx, lineage->node,
+            parent == 'm' ? ped->mothers[lineage->node] : ped->fathers[lineage->node],
+            mother_weight, father_weight);
+    return ped_lineage_set_next_parent(ped, lineage, parent);
+}
+
 int ped_lineage_climb(ped_t *ped, lineage_t *lineage) {
     int ret = 0;
-    node_t *node;
-    int sample_idx;
+    int node, mother, father;
     int mother_num_coal, father_num_coal;
     double mother_weight, father_weight;
     double x;
 
     node = lineage->node;
-    assert(node != NULL);
+    assert(node >= 0);
+    mother = ped->mothers[node];
+    father = ped->fathers[node];
 
-    if (node->mother == NULL && node->father == NULL) {
+    if (mother == -1 && father == -1) {
         ped_lineage_reached_founder(ped, lineage);
         goto out;
     }
 
     mother_weight = father_weight = 0;
     mother_num_coal = father_num_coal = 0;
-    if (node->mother != NULL) {
-        mother_weight = node_get_parent_weight(node->mother, 0);
-        mother_num_coal = node_get_max_coalescences(ped, node->mother);
+    if (mother != -1) {
+        mother_weight = node_get_parent_weight(ped, mother, 0);
+        mother_num_coal = node_get_max_coalescences(ped, mother);
     }
-    if (node->father != NULL) {
-        father_weight = node_get_parent_weight(node->father, 0);
-        father_num_coal = node_get_max_coalescences(ped, node->father);
+    if (father != -1) {
+        father_weight = node_get_parent_weight(ped, father, 0);
+        father_num_coal = node_get_max_coalescences(ped, father);
     }
 
     // TODO: Need better handling of when mother/father is NULL
-    printf("%d choosing from %d: %f or %d %f\n",
-            node->ID,
-            node->mother->ID, mother_weight,
-            node->father->ID, father_weight);
-
     assert(mother_weight + father_weight > 0);
 
     // These options are based purely on laws of inheritance - no IS needed
-    if (node->climbed_to_mother == 1) {
+    if (ped->climb_state[node] & CLIMBED_TO_MOTHER) {
         assert(father_num_coal == ped->num_samples);
-        ped_lineage_set_next_parent(ped, lineage, 'f');
+        ped_lineage_choose(ped, lineage, 'f', mother_weight, father_weight);
         goto out;
     }
-    if (node->climbed_to_father == 1) {
+    if (ped->climb_state[node] & CLIMBED_TO_FATHER) {
         assert(mother_num_coal == ped->num_samples);
-        ped_lineage_set_next_parent(ped, lineage, 'm');
+        ped_lineage_choose(ped, lineage, 'm', mother_weight, father_weight);
         goto out;
     }
 
     // TODO: Add IS factors
     if (mother_num_coal < ped->num_samples) {
         assert(father_num_coal == ped->num_samples);
-        ped_lineage_set_next_parent(ped, lineage, 'f');
+        ped_lineage_choose(ped, lineage, 'f', mother_weight, father_weight);
         goto out;
     }
     if (father_num_coal < ped->num_samples) {
         assert(mother_num_coal == ped->num_samples);
-        ped_lineage_set_next_parent(ped, lineage, 'm');
+        ped_lineage_choose(ped, lineage, 'm', mother_weight, father_weight);
         goto out;
     }
 
-    x = gsl_rng_uniform(ped->rng);
+    x = rng_uniform(&ped->rng);
     if (x < mother_weight / (mother_weight + father_weight)) {
-        ped_lineage_set_next_parent(ped, lineage, 'm');
+        ped_lineage_choose(ped, lineage, 'm', mother_weight, father_weight);
     } else {
-        ped_lineage_set_next_parent(ped, lineage, 'f');
+        ped_lineage_choose(ped, lineage, 'f', mother_weight, father_weight);
         goto out;
     }
 out:
@@ -690,7 +2217,7 @@ int ped_climb_step(ped_t *ped) {
     int ret = 0;
     int i, j, n;
     lineage_t tmp;
-    lineage_t *lineage;
+    uint64_t start = stats_clock(&ped->stats);
 
     // Swap random node with last node and choose from remaining.
     // Repeat until done
@@ -698,14 +2225,16 @@ int ped_climb_step(ped_t *ped) {
     // Use local variable for loop since num_active_lineages changes
     // if a lineage coalesces
     n = ped->num_active_lineages;
+    ped->stats.climb_steps++;
+    ped->stats.climbs += n;
     for (i = n - 1; i >= 0; i--) {
-        j = gsl_rng_uniform_int(ped->rng, i + 1);
+        j = rng_uniform_int(&ped->rng, i + 1);
         tmp = ped->active_lineages[j];
         ped->active_lineages[j] = ped->active_lineages[i];
         ped->active_lineages[i] = tmp;
 
-        printf("climbing lineage %d array index %d\n",
-                ped->active_lineages[i].idx, i);
+        TRACE_EVENT(&ped->trace, TRACE_CLIMB, ped->active_lineages[i].idx,
+                ped->active_lineages[i].node, -1, 0, 0);
         assert(ped->active_lineages[i].status == 'A');
         ret = ped_lineage_climb(ped, &ped->active_lineages[i]);
         if (ret != 0) {
@@ -713,5 +2242,30 @@ int ped_climb_step(ped_t *ped) {
         }
     }
 out:
+    STATS_TIME(&ped->stats, climb_step_ns, start);
+    return ret;
+}
+
+int ped_simulate(ped_t *ped, uint32_t max_steps, uint32_t *num_steps) {
+    // Climbs until every lineage has coalesced or reached a founder, or
+    // until max_steps steps have been taken if max_steps is not 0
+    int ret = PED_SIMULATE_DONE;
+    uint32_t steps = 0;
+
+    while (ped->num_active_lineages > 0) {
+        if (max_steps != 0 && steps == max_steps) {
+            ret = PED_SIMULATE_MAX_STEPS;
+            goto out;
+        }
+        if (ped_climb_step(ped) != 0) {
+            ret = PED_SIMULATE_ERROR;
+            goto out;
+        }
+        steps++;
+    }
+out:
+    if (num_steps != NULL) {
+        *num_steps = steps;
+    }
     return ret;
 }
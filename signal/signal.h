@@ -1,41 +1,178 @@
 #ifndef SIGNAL
 #define SIGNAL
-#include <gsl/gsl_rng.h>
+#include <stdint.h>
 
-typedef struct node_t_t {
-    int ID;
-    double weight;
-    int genotype;
+#include "arena.h"
+#include "trace.h"
+#include "stats.h"
+#include "rng.h"
 
-    struct node_t_t *mother;
-    struct node_t_t *father;
-    int climbed_to_mother;
-    int climbed_to_father;
+// Ancestors this many generations or more from the node being weighed are
+// left out of node_get_parent_weight. Their terms are scaled by at most
+// 2^-(d(d-1)/2), which is below double precision for any realistic weight.
+// This is the default and the most ped_set_parent_weight_depth allows.
+#define PED_PARENT_WEIGHT_DEPTH 16
 
-    int *active_samples; // Store length of array here as well as ped?
-} node_t;
+// Pedigrees with fewer nodes than this are initialised on one thread, as
+// the barrier after each generation would cost more than the threads save
+#define PED_PARALLEL_INIT_NODES 65536
+
+// Return values of ped_simulate
+#define PED_SIMULATE_DONE 0
+#define PED_SIMULATE_MAX_STEPS 1
+#define PED_SIMULATE_ERROR -1
+
+// Bits of ped->climb_state
+#define CLIMBED_TO_MOTHER 1
+#define CLIMBED_TO_FATHER 2
 
 typedef struct {
     int idx;
-    node_t *node;
+    int32_t node; // Index of the node the lineage currently sits in
     char status; // A - active, C - coalesced, F - founder
 } lineage_t;
 
-// Not used/needed?
-typedef struct sample_list_t_t {
-    node_t *node;
-    struct sample_list_t_t *next;
-} sample_list_t;
+// Per-node work space for walks over the pedigree, which peds stepped in
+// turn from one thread can share
+typedef struct {
+    // FIFO ring of nodes whose max_coal needs repairing
+    char *coal_queued;
+    int32_t *coal_queue;
+    uint32_t coal_queue_head;
+    uint32_t coal_queue_len;
+
+    // Worklist for ped_update_ancestor_weights, bucketed by generation.
+    // update_head[g] starts a list of queued nodes linked by update_next,
+    // and update_delta holds the summed delta still to apply to each. It is
+    // always left empty.
+    int32_t *update_head;
+    int32_t *update_next;
+    char *update_queued;
+    double *update_delta;
+
+    // Scratch for node_get_parent_weight. A node is in the current
+    // ancestral cone when its pw_mark equals pw_query, and pw_slot is then
+    // its row in pw_table.
+    uint32_t pw_query;
+    uint32_t *pw_mark;
+    int32_t *pw_slot;
+    int32_t *pw_cone;
+    int32_t *pw_dist;
+    double *pw_table;
+    uint32_t pw_table_rows;
+} ped_scratch_t;
 
 typedef struct {
     uint32_t num_nodes;
     uint32_t num_samples;
+    uint32_t num_sample_words;
     uint32_t num_active_lineages;
     double sim_homs;
-    node_t *node_array;
-    node_t **samples;
+    trace_t trace; // Climbing events, see ped_trace_enable
+    stats_t stats;
+
+    // Log importance sampling weight of the current simulation, and where
+    // its most recent coalescence and founder were, or -1 if none yet
+    double loglik;
+    int32_t last_coal_node;
+    int32_t last_founder;
+
+    // Holds every array sized by num_nodes or num_samples, allocated in
+    // one go by ped_nodes_alloc and released in one go by free_ped.
+    // max_samples is the number of samples it has room for.
+    arena_t arena;
+    int arena_flags;
+    uint32_t max_samples;
+
+    // Read-only mapping of the snapshot file the pedigree arrays point
+    // into, if it was loaded by ped_load_mmap
+    char *snapshot;
+    size_t snapshot_size;
+
+    // When nodes have been renumbered, node i was index node_idx[i] in the
+    // arrays the pedigree was loaded from, and index j became node
+    // idx_node[j], or -1 if it was pruned away. Both are NULL otherwise.
+    int32_t *node_idx;
+    int32_t *idx_node;
+    uint32_t num_idx;
+
+    // Nodes are stored as a struct of arrays, one entry per node, so that
+    // ancestor walks only pull in the fields they read. Parents are node
+    // indices, or -1 when unknown.
+    int32_t *ids;
+    int32_t *fathers;
+    int32_t *mothers;
+    double *weights;
+    int8_t *genotypes;
+    uint8_t *climb_state;
+    uint64_t *active_samples; // num_sample_words per node, see node_samples
+
+    int32_t *samples;
+    int8_t *sample_genotypes; // Genotype each sample starts a simulation with
     lineage_t *active_lineages;
-    gsl_rng *rng;
+    rng_t rng;
+
+    // Offspring of node i are offspring[offspring_start[i]] up to
+    // offspring[offspring_start[i + 1]]
+    uint32_t *offspring_start;
+    int32_t *offspring;
+
+    // Founders are generation 0, everyone else is one more than their
+    // deepest parent, so parents always have a smaller generation
+    int32_t *gens;
+    uint32_t max_gen;
+    // Every node, sorted by generation from the deepest to the founders, so
+    // offspring always come before their parents. Generation max_gen - k
+    // is gen_order[gen_start[k]] up to gen_order[gen_start[k + 1]].
+    int32_t *gen_order;
+    uint32_t *gen_start;
+
+    // Threads ped_init_sample_weights may use, or 0 for the OpenMP default
+    int num_threads;
+
+    // Cached max number of active samples over each node and its ancestors,
+    // repaired lazily from scratch->coal_queue
+    int32_t *max_coal;
+
+    // Points at own_scratch, or at another ped's for peds made by
+    // ped_share_pedigree with a scratch ped
+    ped_scratch_t *scratch;
+    ped_scratch_t own_scratch;
+    double pw_scale[PED_PARENT_WEIGHT_DEPTH];
+
+    // node_get_parent_weight stops pw_depth generations up, or with a
+    // pw_tolerance above 0, at the shallowest depth up to pw_depth whose
+    // error bound is within it. pw_error bounds what the last call left
+    // out. weight_bound is at least the largest absolute weight of any
+    // node, which the bound is scaled by.
+    uint32_t pw_depth;
+    double pw_tolerance;
+    double pw_error;
+    double weight_bound;
+
+    // Undo journal for ped_reset. ped_init_sample_weights opens it, and the
+    // first change a simulation makes to a node saves the node's state as
+    // it was after initialisation to the next entry. A node is journaled
+    // when its journal_mark equals journal_epoch, and 0 means there is no
+    // journal to reset from. journal_samples is num_sample_words per entry.
+    //
+    // Peds made by ped_share_pedigree are sparse: nodes outside the
+    // ancestry of their samples are left at zero, and their journal is
+    // opened by ped_clear_state and only lists the nodes changed since, with
+    // no saved state, so that clearing and initialising them takes time in
+    // proportion to the ancestry rather than the whole pedigree.
+    int sparse;
+    uint32_t journal_epoch;
+    uint32_t journal_epochs;
+    uint32_t journal_len;
+    uint32_t *journal_mark;
+    int32_t *journal_nodes;
+    double *journal_weights;
+    int8_t *journal_genotypes;
+    uint8_t *journal_climb_state;
+    int32_t *journal_max_coal;
+    uint64_t *journal_samples;
+    uint32_t journal_samples_capacity;
 } ped_t;
 
 void multiply_by_10_in_C(double arr[], unsigned int n);
@@ -43,29 +180,57 @@ void multiply_by_10_in_C(double arr[], unsigned int n);
 ped_t *ped_alloc(void);
 int ped_nodes_alloc(ped_t *ped, uint32_t num_nodes, int num_samples);
 int ped_samples_alloc(ped_t *ped, uint32_t num_samples);
-int ped_alloc_rng(ped_t *ped);
+int ped_set_seed(ped_t *ped, uint64_t seed, uint64_t stream);
+uint64_t ped_default_seed(void);
+int ped_use_huge_pages(ped_t *ped, int enable);
+int ped_set_num_threads(ped_t *ped, int num_threads);
+int ped_share_topology(ped_t *ped, ped_t *shared);
+int ped_share_pedigree(ped_t *ped, ped_t *shared, uint32_t max_samples,
+        ped_t *scratch);
+int ped_trace_enable(ped_t *ped, uint32_t capacity);
+int ped_stats_enable_timers(ped_t *ped, int enable);
+size_t ped_heap_bytes(ped_t *ped);
 int free_ped(ped_t *ped);
 
 int ped_load(ped_t *ped, int *inds, int *fathers, int *mothers, int num_inds);
+int ped_load_pruned(ped_t *ped, int *inds, int *fathers, int *mothers,
+        int num_inds, int *samples_idx, int num_samples);
+int ped_reorder_generations(ped_t *ped);
+int ped_node_from_idx(ped_t *ped, int idx);
+int ped_idx_from_node(ped_t *ped, int node);
+int ped_save_snapshot(ped_t *ped, const char *path, int flags);
+int ped_load_mmap(ped_t *ped, const char *path, int num_samples);
+int ped_build_offspring(ped_t *ped);
+int ped_build_generations(ped_t *ped);
 int ped_load_samples_from_idx(ped_t *ped, int *samples_idx, int *genotypes, int num_samples);
+int ped_load_samples_from_node(ped_t *ped, const int32_t *nodes,
+        const int *genotypes, uint32_t num_samples);
 int ped_init_sample_weights(ped_t *ped);
+int ped_clear_state(ped_t *ped);
+int ped_restart(ped_t *ped);
+int ped_reset(ped_t *ped);
 
 int ped_print_nodes(ped_t *ped);
 int ped_print_samples(ped_t *ped);
-void print_node(node_t node);
 
-int ped_update_ancestor_weights(ped_t *ped, node_t *node, int sample_idx, double delta);
+uint64_t *node_samples(ped_t *ped, int node);
+int ped_update_ancestor_weights(ped_t *ped, int node, int sample_idx, double delta);
 int ped_update_ancestor_weights_from_idx(ped_t *ped, int node_idx, double delta);
 int ped_set_all_weights(ped_t *ped, double val);
 double ped_get_node_weight_from_idx(ped_t *ped, int node_idx);
-double node_get_parent_weight(node_t *node, int gen);
-int update_parent_carrier(ped_t *ped, node_t *node, int sample_idx);
-int update_parent_not_carrier(ped_t *ped, node_t *node, int sample_idx);
+double node_get_parent_weight(ped_t *ped, int node, int gen);
+int ped_set_parent_weight_depth(ped_t *ped, uint32_t depth, double tolerance);
+double ped_parent_weight_error(ped_t *ped, uint32_t depth, int gen);
+int update_parent_carrier(ped_t *ped, int node, int sample_idx);
+int update_parent_not_carrier(ped_t *ped, int node, int sample_idx);
 int update_parent_carrier_from_idx(ped_t *ped, int node_idx, int sample_idx);
 int update_parent_not_carrier_from_idx(ped_t *ped, int node_idx, int sample_idx);
-int node_get_max_coalescences(ped_t *ped, node_t *node);
+int node_get_max_coalescences(ped_t *ped, int node);
+int ped_mark_coalescences_dirty(ped_t *ped, int node);
+int ped_repair_max_coalescences(ped_t *ped);
 
 int ped_climb_step(ped_t *ped);
+int ped_simulate(ped_t *ped, uint32_t max_steps, uint32_t *num_steps);
 int ped_lineage_coalesce(ped_t *ped, lineage_t *lineage);
 int ped_lineage_climb(ped_t *ped, lineage_t *lineage);
 int ped_lineage_set_next_parent(ped_t *ped, lineage_t *lineage, char parent);
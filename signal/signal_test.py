@@ -1,4 +1,4 @@
-import sys, os
+import sys, os, tempfile
 import numpy as np
 import time
 
@@ -10,11 +10,19 @@ import pysignal
 # pedfile = os.path.expanduser('~/project/anc_finder/data/pedEx.txt')
 pedfile = os.path.expanduser(
         '~/project/anc_finder/scripts/test/test_data/pedEx2.txt')
+if len(sys.argv) > 1:
+    pedfile = sys.argv[1]
+if not os.path.exists(pedfile):
+    ## Falls back on a small synthetic pedigree, written outside the source
+    ## tree
+    pedfile = os.path.join(tempfile.mkdtemp(), 'synthetic_ped.txt')
+    pysignal.generate_ped(pedfile, generations=6, founders=50, pop_size=100,
+                          sib_mating=0.1)
 # pedfile = os.path.expanduser(
 #         '~/project/anc_finder/scripts/test/test_data/pedEx3.txt')
 P = ped.Pedigree(pedfile)
 
-ped_arr = pysignal.sort_ped(P)
+ped_arr = pysignal.read_ped(pedfile)
 ninds = len(P.inds)
 print len(P.probands), "probands"
 sample_idx = [P.ind_dict[x] for x in list(P.probands)[:10]]
@@ -32,13 +40,12 @@ cP.init_sample_weights()
 
 # cP.set_all_weights(1)
 cP.print_nodes()
-cP.climb_step()
-cP.print_nodes()
-cP.climb_step()
-cP.print_nodes()
-cP.climb_step()
-cP.print_nodes()
-cP.climb_step()
+cP.trace()
+finished, num_steps = cP.simulate()
+print "Finished:", finished, "after", num_steps, "steps"
+for event in cP.drain_trace():
+    print pysignal.trace_types[event['type']], event['lineage'], \
+            event['node'], event['parent']
 cP.print_nodes()
 
 print("Success!")
@@ -0,0 +1,44 @@
+#ifndef SNAPSHOT
+#define SNAPSHOT
+#include <stdint.h>
+
+// Binary pedigree snapshots, written by ped_save_snapshot and mapped
+// straight into a ped by ped_load_mmap. Arrays are stored in host byte
+// order at the offsets given in the header, each starting on its own
+// cache line:
+//
+//   ids, fathers, mothers    int32_t[num_nodes], parents -1 when unknown
+//   offspring_start          uint32_t[num_nodes + 1]
+//   offspring                int32_t[offspring_start[num_nodes]]
+//   gens                     int32_t[num_nodes], if SNAPSHOT_HAS_GENS
+//   node_idx                 int32_t[num_nodes], if SNAPSHOT_HAS_INDEX
+//   idx_node                 int32_t[num_idx], if SNAPSHOT_HAS_INDEX
+#define SNAPSHOT_MAGIC "PEDSNAP"
+#define SNAPSHOT_VERSION 2
+#define SNAPSHOT_BYTE_ORDER 0x01020304
+#define SNAPSHOT_ALIGN 64
+
+// Bits of snapshot_header_t.flags
+#define SNAPSHOT_HAS_GENS 1
+// Nodes were pruned or renumbered, so indices have to go through the maps
+#define SNAPSHOT_HAS_INDEX 2
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order; // SNAPSHOT_BYTE_ORDER as written by the host
+    uint32_t flags;
+    uint32_t num_nodes;
+    uint32_t num_offspring;
+    uint32_t max_gen;
+    uint64_t ids_offset;
+    uint64_t fathers_offset;
+    uint64_t mothers_offset;
+    uint64_t offspring_start_offset;
+    uint64_t offspring_offset;
+    uint64_t gens_offset;
+    uint64_t node_idx_offset;
+    uint64_t idx_node_offset;
+    uint32_t num_idx;
+} snapshot_header_t;
+#endif
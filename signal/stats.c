@@ -0,0 +1,35 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "stats.h"
+
+void stats_reset(stats_t *stats) {
+    // Zeroes the counts, leaving the timers on or off
+    int timers = stats->timers;
+
+    memset(stats, 0, sizeof(stats_t));
+    stats->timers = timers;
+}
+
+void stats_add(stats_t *total, const stats_t *stats) {
+    total->update_calls += stats->update_calls;
+    total->update_nodes += stats->update_nodes;
+    total->update_ns += stats->update_ns;
+    total->parent_weight_calls += stats->parent_weight_calls;
+    total->parent_weight_nodes += stats->parent_weight_nodes;
+    total->parent_weight_depth += stats->parent_weight_depth;
+    if (stats->parent_weight_max_depth > total->parent_weight_max_depth) {
+        total->parent_weight_max_depth = stats->parent_weight_max_depth;
+    }
+    total->parent_weight_ns += stats->parent_weight_ns;
+    total->max_coal_calls += stats->max_coal_calls;
+    total->max_coal_repairs += stats->max_coal_repairs;
+    total->climb_steps += stats->climb_steps;
+    total->climbs += stats->climbs;
+    total->climb_step_ns += stats->climb_step_ns;
+    total->init_calls += stats->init_calls;
+    total->init_ns += stats->init_ns;
+    total->restarts += stats->restarts;
+    total->resets += stats->resets;
+    total->reset_nodes += stats->reset_nodes;
+}
@@ -0,0 +1,52 @@
+#ifndef STATS
+#define STATS
+#include <stdint.h>
+#include <time.h>
+
+// Counts of the work done by a ped's hot paths, since the ped was made or
+// since stats_reset. Counting costs an add per event. Times are in
+// nanoseconds, inclusive of any timed calls made inside, and only kept
+// while timers is set, as reading the clock costs more than the counting.
+typedef struct {
+    uint64_t update_calls; // ped_update_ancestor_weights
+    uint64_t update_nodes; // Ancestors whose weight those calls changed
+    uint64_t update_ns;
+    uint64_t parent_weight_calls; // node_get_parent_weight
+    uint64_t parent_weight_nodes; // Ancestors in the cones walked
+    uint64_t parent_weight_depth; // Sum over cones of their deepest level
+    uint64_t parent_weight_max_depth;
+    uint64_t parent_weight_ns;
+    uint64_t max_coal_calls; // node_get_max_coalescences
+    uint64_t max_coal_repairs; // Nodes taken off coal_queue
+    uint64_t climb_steps; // ped_climb_step
+    uint64_t climbs; // Lineages climbed by those steps
+    uint64_t climb_step_ns;
+    uint64_t init_calls; // ped_init_sample_weights
+    uint64_t init_ns;
+    uint64_t restarts; // ped_restart, including when ped_reset falls back
+    uint64_t resets; // ped_reset from the journal
+    uint64_t reset_nodes; // Nodes put back by those resets
+    int timers;
+} stats_t;
+
+void stats_reset(stats_t *stats);
+void stats_add(stats_t *total, const stats_t *stats);
+
+static inline uint64_t stats_clock(stats_t *stats) {
+    struct timespec ts;
+
+    if (!stats->timers) {
+        return 0;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Adds the time since start, a stats_clock reading, to counter
+#define STATS_TIME(stats, counter, start) \
+    do { \
+        if ((stats)->timers) { \
+            (stats)->counter += stats_clock(stats) - (start); \
+        } \
+    } while (0)
+#endif
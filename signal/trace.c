@@ -0,0 +1,67 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+int trace_alloc(trace_t *trace, uint32_t capacity) {
+    // Capacity is rounded up to a power of 2 so that ring positions are a
+    // mask rather than a division
+    int ret = 0;
+    uint32_t size = 1;
+
+    while (size < capacity && size < (UINT32_C(1) << 31)) {
+        size <<= 1;
+    }
+
+    trace_free(trace);
+    trace->events = malloc(size * sizeof(trace_event_t));
+    if (trace->events == NULL) {
+        ret = 1;
+        goto out;
+    }
+    trace->capacity = size;
+out:
+    return ret;
+}
+
+int trace_free(trace_t *trace) {
+    free(trace->events);
+    trace->events = NULL;
+    trace->capacity = 0;
+    trace->head = 0;
+    trace->tail = 0;
+    trace->enabled = 0;
+
+    return 0;
+}
+
+uint32_t trace_pending(trace_t *trace) {
+    return trace->head - trace->tail;
+}
+
+uint32_t trace_drain(trace_t *trace, trace_event_t *out, uint32_t max_events) {
+    // Copies out up to max_events of the oldest events not yet drained, in
+    // the order they were recorded, and returns how many were copied
+    uint32_t n, start, first;
+
+    n = trace_pending(trace);
+    if (n > max_events) {
+        n = max_events;
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    // At most two contiguous runs, split where the ring wraps
+    start = trace->tail & (trace->capacity - 1);
+    first = trace->capacity - start;
+    if (first > n) {
+        first = n;
+    }
+    memcpy(out, trace->events + start, first * sizeof(trace_event_t));
+    memcpy(out + first, trace->events, (n - first) * sizeof(trace_event_t));
+    trace->tail += n;
+
+    return n;
+}
@@ -0,0 +1,70 @@
+#ifndef TRACE
+#define TRACE
+#include <stdint.h>
+
+// Types of trace_event_t
+#define TRACE_CLIMB 1 // Lineage about to climb out of node
+#define TRACE_CHOICE 2 // Lineage in node chose parent, given both weights
+#define TRACE_COALESCE 3 // Lineage coalesced in node
+#define TRACE_FOUNDER 4 // Lineage reached founder node
+#define TRACE_HOMOZYGOTE 5 // Node was made a homozygote by lineage
+
+typedef struct {
+    uint32_t seq; // Number of events recorded before this one, mod 2^32
+    int32_t lineage;
+    int32_t node;
+    int32_t parent; // -1 unless type is TRACE_CHOICE
+    float mother_weight;
+    float father_weight;
+    uint8_t type;
+} trace_event_t;
+
+// Ring of the most recent events. head counts every event ever recorded
+// and tail is the oldest one not yet drained; once the ring is full each
+// new event overwrites the oldest.
+typedef struct {
+    trace_event_t *events;
+    uint32_t capacity; // Always a power of 2
+    uint64_t head;
+    uint64_t tail;
+    int enabled;
+} trace_t;
+
+int trace_alloc(trace_t *trace, uint32_t capacity);
+int trace_free(trace_t *trace);
+uint32_t trace_pending(trace_t *trace);
+uint32_t trace_drain(trace_t *trace, trace_event_t *out, uint32_t max_events);
+
+static inline void trace_record(trace_t *trace, uint8_t type, int32_t lineage,
+        int32_t node, int32_t parent, double mother_weight,
+        double father_weight) {
+    trace_event_t *e;
+
+    e = &trace->events[trace->head & (trace->capacity - 1)];
+    e->seq = (uint32_t) trace->head;
+    e->type = type;
+    e->lineage = lineage;
+    e->node = node;
+    e->parent = parent;
+    e->mother_weight = mother_weight;
+    e->father_weight = father_weight;
+
+    trace->head++;
+    if (trace->head - trace->tail > trace->capacity) {
+        trace->tail = trace->head - trace->capacity;
+    }
+}
+
+// Tracing costs one predictable branch per event when built in but switched
+// off, and nothing at all in release builds
+#ifdef NDEBUG
+#define TRACE_EVENT(trace, type, lineage, node, parent, mw, fw)
+#else
+#define TRACE_EVENT(trace, type, lineage, node, parent, mw, fw) \
+    do { \
+        if ((trace)->enabled) { \
+            trace_record(trace, type, lineage, node, parent, mw, fw); \
+        } \
+    } while (0)
+#endif
+#endif
@@ -0,0 +1,163 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "signal.h"
+#include "ensemble.h"
+#include "variants.h"
+
+int variants_alloc(variants_t *variants, ped_t *shared, uint32_t batch_size,
+        uint32_t max_samples, uint64_t seed) {
+    // shared must have its pedigree loaded, and must not be changed or
+    // freed while variants exists. Its own samples are not used, and its
+    // stats are only written by variants_free.
+    int ret = 0;
+    uint32_t i;
+
+    variants->shared = shared;
+    variants->batch_size = batch_size;
+    variants->max_samples = max_samples;
+    variants->seed = seed;
+    variants->peds = calloc(batch_size, sizeof(ped_t *));
+    if (variants->peds == NULL) {
+        variants->batch_size = 0;
+        ret = 1;
+        goto out;
+    }
+
+    // Slots are stepped in turn from one thread, so they all use the work
+    // space of the first and only hold the state of their own variant
+    for (i = 0; i < batch_size; i++) {
+        variants->peds[i] = ped_alloc();
+        variants->peds[i]->arena_flags = shared->arena_flags;
+        ret = ped_share_pedigree(variants->peds[i], shared, max_samples,
+                i == 0 ? NULL : variants->peds[0]);
+        if (ret != 0) {
+            goto out;
+        }
+    }
+out:
+    return ret;
+}
+
+int variants_free(variants_t *variants) {
+    uint32_t i;
+
+    // The first slot holds the work space of the others, so goes last
+    for (i = variants->batch_size; i-- > 0;) {
+        if (variants->peds[i] != NULL) {
+            // As in ensemble_free, the work done on the shared ped's behalf
+            // is merged here rather than by variants_run
+            stats_add(&variants->shared->stats, &variants->peds[i]->stats);
+            free_ped(variants->peds[i]);
+        }
+    }
+    free(variants->peds);
+    variants->peds = NULL;
+    variants->batch_size = 0;
+
+    return 0;
+}
+
+static int variants_start(variants_t *variants, ped_t *ped, uint32_t v,
+        const uint32_t *sample_start, const int *samples_idx,
+        const int *genotypes, int32_t *nodes) {
+    // Loads the samples of variant v into ped, ready to climb
+    int ret = 0;
+    uint32_t i, num_samples;
+
+    num_samples = sample_start[v + 1] - sample_start[v];
+    if (num_samples > variants->max_samples) {
+        printf("Error - variant %u has %u samples, more than %u\n", v,
+                num_samples, variants->max_samples);
+        ret = 1;
+        goto out;
+    }
+    for (i = 0; i < num_samples; i++) {
+        nodes[i] = ped_node_from_idx(variants->shared,
+                samples_idx[sample_start[v] + i]);
+        if (nodes[i] < 0 || nodes[i] >= variants->shared->num_nodes) {
+            printf("Error - sample %d of variant %u is not in the pedigree\n",
+                    samples_idx[sample_start[v] + i], v);
+            ret = 1;
+            goto out;
+        }
+    }
+    ret = ped_load_samples_from_node(ped, nodes, genotypes + sample_start[v],
+            num_samples);
+    if (ret != 0) {
+        goto out;
+    }
+    ped_set_seed(ped, variants->seed, v);
+    // Only clears what the slot's last variant changed
+    ret = ped_reset(ped);
+out:
+    return ret;
+}
+
+int variants_run(variants_t *variants, const uint32_t *sample_start,
+        const int *samples_idx, const int *genotypes, uint32_t num_variants,
+        replicate_t *results) {
+    // The samples and genotypes of variant i are entries sample_start[i] up
+    // to sample_start[i + 1] of samples_idx and genotypes, with samples
+    // given as indices as loaded. Each variant is simulated to completion
+    // once, and its outcome written to results[i].
+    int ret = 0;
+    uint32_t first, i, num_active, batch;
+    int32_t *nodes = NULL;
+    ped_t *ped;
+
+    nodes = malloc((variants->max_samples + 1) * sizeof(int32_t));
+    if (nodes == NULL) {
+        ret = 1;
+        goto out;
+    }
+    for (i = 0; i < num_variants; i++) {
+        results[i].done = 0;
+    }
+    for (first = 0; first < num_variants; first += variants->batch_size) {
+        batch = num_variants - first;
+        if (batch > variants->batch_size) {
+            batch = variants->batch_size;
+        }
+        for (i = 0; i < batch; i++) {
+            ret = variants_start(variants, variants->peds[i], first + i,
+                    sample_start, samples_idx, genotypes, nodes);
+            if (ret != 0) {
+                goto out;
+            }
+            results[first + i].num_steps = 0;
+        }
+
+        // One step of every unfinished variant per round, so the batch
+        // moves up the pedigree together
+        num_active = batch;
+        while (num_active > 0) {
+            num_active = 0;
+            for (i = 0; i < batch; i++) {
+                ped = variants->peds[i];
+                if (ped->num_active_lineages == 0) {
+                    continue;
+                }
+                ret = ped_climb_step(ped);
+                if (ret != 0) {
+                    goto out;
+                }
+                // The coal queue is shared with the other slots
+                ped_repair_max_coalescences(ped);
+                results[first + i].num_steps++;
+                if (ped->num_active_lineages > 0) {
+                    num_active++;
+                }
+            }
+        }
+
+        for (i = 0; i < batch; i++) {
+            replicate_record(&results[first + i], variants->peds[i],
+                    variants->shared);
+        }
+    }
+out:
+    free(nodes);
+    return ret;
+}
@@ -0,0 +1,32 @@
+#ifndef VARIANTS
+#define VARIANTS
+#include <stdint.h>
+
+#include "signal.h"
+#include "ensemble.h"
+
+// Simulates many variants over one loaded pedigree, each with its own
+// samples and genotypes. Only batch_size variants have simulation state at
+// a time, one ped per slot sharing the pedigree arrays of shared and the
+// work space of the first slot, and the slots of a batch take their
+// climbing steps in turn. A slot is reset from its journal between
+// variants, so only the ancestry of its last variant is cleared. Lineages of every
+// variant in a batch climb the same generations at the same time, so the
+// parent arrays they read are still in cache from the previous variant.
+typedef struct {
+    ped_t *shared;
+    uint32_t batch_size;
+    uint32_t max_samples; // Most samples any one variant can have
+    ped_t **peds;
+    // Variant i draws from stream i of seed, so its outcome doesn't depend
+    // on the batch size
+    uint64_t seed;
+} variants_t;
+
+int variants_alloc(variants_t *variants, ped_t *shared, uint32_t batch_size,
+        uint32_t max_samples, uint64_t seed);
+int variants_run(variants_t *variants, const uint32_t *sample_start,
+        const int *samples_idx, const int *genotypes, uint32_t num_variants,
+        replicate_t *results);
+int variants_free(variants_t *variants);
+#endif